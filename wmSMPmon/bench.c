@@ -0,0 +1,558 @@
+/*######################################################################
+  #                                                                    #
+  # Micro benchmarks for the wmSMPmon sampling and drawing code.       #
+  # Build and run with 'make bench'.                                   #
+  #                                                                    #
+  # Every benchmark reports the time, the number of allocations and,   #
+  # where the kernel lets us count them, the CPU cycles per operation, #
+  # else the time stamp counter ticks on x86. Inputs are synthetic or  #
+  # read from the recorded files in fixtures/, so results only depend  #
+  # on the machine. Drawing replays fixtures/render.cap into the frame #
+  # buffer, without an X server.                                       #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <X11/Xlib.h>
+#include <X11/xpm.h>
+#include "sysinfo-linux.h"
+#include "standards.h"
+#include "wmgeneral.h"
+#include "history.h"
+#include "graph.h"
+#include "wmSMPmon_master.xpm"
+
+/* the sscanf formats used by wmSMPmon up to 4.0, kept for comparison */
+#define CPU_FMTS_JUST1  "cpu %Lu %Lu %Lu %Lu %Lu %Lu %Lu"
+#define CPU_FMTS_MULTI  "cpu%*d %Lu %Lu %Lu %Lu %Lu %Lu %Lu"
+
+/* CPU counts to run the /proc/stat benchmarks with */
+static const unsigned int bench_cpus[] = { 1, 8, 64, 128, 192, 1024 };
+
+/* where the fixtures are unless given on the command line */
+#define FIXTURES "fixtures"
+
+/*###### Counters #######################################################*/
+
+static unsigned long alloc_count;
+
+#ifdef BENCH_COUNT_ALLOCS
+/* linked with -Wl,--wrap=malloc etc., see Makefile.am */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	alloc_count++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __real_realloc(ptr, size);
+}
+#endif
+
+static int cycles_fd = -1;
+static int cycles_tsc;
+
+/* CPU cycles of this thread, often not permitted in containers and VMs.
+ * On x86, the time stamp counter is read instead; it ticks at a fixed
+ * rate, whatever the clock of the core, and on other threads too. */
+static void cycles_open(void)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CPU_CYCLES;
+	pe.exclude_hv = 1;
+	cycles_fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+	if (cycles_fd == -1) {
+		/* perf_event_paranoid 2 still allows user space only */
+		pe.exclude_kernel = 1;
+		cycles_fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	cycles_tsc = cycles_fd == -1;
+#endif
+}
+
+static unsigned long long cycles_now(void)
+{
+	unsigned long long n = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (cycles_tsc)
+		return __rdtsc();
+#endif
+	if (cycles_fd == -1 || read(cycles_fd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+	return n;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Runs fn(arg) 'iters' times and prints the cost of one call */
+static void bench_run(const char *name, void (*fn)(void *), void *arg,
+    unsigned long iters)
+{
+	unsigned long k, allocs;
+	unsigned long long cycles;
+	double t;
+	char cyc[32];
+
+	fn(arg); /* warm up caches and buffers */
+
+	allocs = alloc_count;
+	cycles = cycles_now();
+	t = now_ns();
+	for (k = 0; k < iters; k++)
+		fn(arg);
+	t = (now_ns() - t) / iters;
+	cycles = cycles_now() - cycles;
+	allocs = alloc_count - allocs;
+
+	if (cycles_fd == -1 && !cycles_tsc)
+		strcpy(cyc, "-");
+	else
+		snprintf(cyc, sizeof(cyc), "%.0f", (double)cycles / iters);
+#ifdef BENCH_COUNT_ALLOCS
+	printf("%-36s %12.1f %10.2f %12s\n", name, t, (double)allocs / iters,
+	    cyc);
+#else
+	printf("%-36s %12.1f %10s %12s\n", name, t, "-", cyc);
+#endif
+}
+
+/*###### /proc/stat parsing #############################################*/
+
+/* builds a plausible /proc/stat image for 'cpus' CPUs, with tick counts
+ * of realistic and varying widths, followed by the non-cpu lines */
+static char *make_stat(unsigned int cpus, size_t *len)
+{
+	size_t size = 256 + (cpus + 1) * 128, pos = 0;
+	char *buf = malloc(size + STAT_PAD);
+	unsigned long long seed = 88172645463325252ULL;
+	unsigned int c, f;
+
+	if (!buf)
+		exit(1);
+	for (c = 0; c <= cpus; c++) {
+		if (c)
+			pos += sprintf(buf + pos, "cpu%u", c - 1);
+		else
+			pos += sprintf(buf + pos, "cpu ");
+		for (f = 0; f < 10; f++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			pos += sprintf(buf + pos, " %llu",
+			    (seed % 100000000ULL) >> (f * 3));
+		}
+		buf[pos++] = '\n';
+	}
+	pos += sprintf(buf + pos, "intr 123456789 0 9 0 0\nctxt 987654321\n"
+	    "btime 1700000000\nprocesses 123456\nprocs_running 2\n"
+	    "procs_blocked 0\n");
+	memset(buf + pos, 0, STAT_PAD);
+	*len = pos;
+	return buf;
+}
+
+typedef struct stat_bench {
+	char *image;
+	unsigned int cpus;
+	CPU_t ticks;
+	stat_sched sched;
+	unsigned int *load;
+	FILE *fp;
+	/* the pre-4.1 tick storage, for the sscanf and float references */
+	struct old_cpu {
+		TIC_t t[CPU_FIELDS];
+		TIC_t charge, total;
+	} *old;
+} stat_bench;
+
+/* the pre-4.1 path: fgets() and sscanf() per line from a stdio stream */
+static void stat_parse_sscanf(FILE *fp, struct old_cpu *cpus,
+    unsigned int Cpu_tot)
+{
+	char buf[SMLBUFSIZ];
+	unsigned int i;
+	TIC_t *t;
+
+	rewind(fp);
+	fflush(fp);
+	if (!fgets(buf, sizeof(buf), fp))
+		return;
+	t = cpus[Cpu_tot].t;
+	sscanf(buf, CPU_FMTS_JUST1, &t[0], &t[1], &t[2], &t[3], &t[4], &t[5],
+	    &t[6]);
+	if (1 == Cpu_tot)
+		cpus[0] = cpus[1];
+	for (i = 0; 1 < Cpu_tot && i < Cpu_tot; i++) {
+		if (!fgets(buf, sizeof(buf), fp))
+			return;
+		t = cpus[i].t;
+		sscanf(buf, CPU_FMTS_MULTI, &t[0], &t[1], &t[2], &t[3], &t[4],
+		    &t[5], &t[6]);
+	}
+}
+
+/* the pre-4.1 load math, with a floating point divide per CPU */
+static void cpu_load_float(struct old_cpu *cpus, unsigned int *load,
+    unsigned int Cpu_tot)
+{
+	unsigned int j;
+	unsigned long charge, total;
+
+	for (j = 0; j < Cpu_tot; j++) {
+		charge = cpus[j].t[CPU_U] + cpus[j].t[CPU_S] + cpus[j].t[CPU_N];
+		total = charge + cpus[j].t[CPU_I];
+		load[j] = ((HEIGHT * (charge - cpus[j].charge)) /
+		    (total - cpus[j].total + 0.001)) + 1;
+		cpus[j].total = total;
+		cpus[j].charge = charge;
+	}
+}
+
+/* true if the ticks parsed into 'old' and 'ticks' are the same */
+static int ticks_equal(const struct old_cpu *old, const CPU_t *ticks,
+    unsigned int Cpu_tot)
+{
+	unsigned int j, f;
+
+	for (j = 0; j <= Cpu_tot; j++)
+		for (f = 0; f < CPU_FIELDS; f++)
+			if (old[j].t[f] != ticks->tic[f][j])
+				return 0;
+	return 1;
+}
+
+static void op_stat_sscanf(void *arg)
+{
+	stat_bench *b = arg;
+
+	stat_parse_sscanf(b->fp, b->old, b->cpus);
+}
+
+static void op_stat_parse(void *arg)
+{
+	stat_bench *b = arg;
+
+	stat_parse(b->image, &b->ticks, b->cpus, &b->sched);
+}
+
+static void op_load_math(void *arg)
+{
+	stat_bench *b = arg;
+
+	cpu_load_update(&b->ticks, b->load, b->cpus);
+}
+
+static void op_load_float(void *arg)
+{
+	stat_bench *b = arg;
+
+	cpu_load_float(b->old, b->load, b->cpus);
+}
+
+/* compares cpu_load_update with the float math on the ticks of 'b' and
+ * on a second, slightly later set of ticks */
+static void check_load_math(stat_bench *b)
+{
+	unsigned int *ref = calloc(b->cpus, sizeof(unsigned int));
+	unsigned int j, f, step, bad = 0;
+
+	if (!ref)
+		exit(1);
+	memset(b->ticks.charge, 0, (b->cpus + 1) * sizeof(TIC_t));
+	memset(b->ticks.total, 0, (b->cpus + 1) * sizeof(TIC_t));
+	for (j = 0; j <= b->cpus; j++)
+		b->old[j].charge = b->old[j].total = 0;
+	for (step = 0; step < 2; step++) {
+		cpu_load_float(b->old, ref, b->cpus);
+		cpu_load_update(&b->ticks, b->load, b->cpus);
+		for (j = 0; j < b->cpus; j++)
+			if (ref[j] != b->load[j])
+				bad++;
+		/* advance every counter by a different amount */
+		for (j = 0; j <= b->cpus; j++)
+			for (f = 0; f < CPU_FIELDS; f++)
+				b->old[j].t[f] = b->ticks.tic[f][j] +=
+				    (j * 7 + f * 13) % 97;
+	}
+	if (bad)
+		fprintf(stderr, "cpu_load_update: %u loads differ from the "
+		    "float math for %u CPUs\n", bad, b->cpus);
+	free(ref);
+}
+
+static void bench_stat(unsigned int cpus)
+{
+	unsigned long iters = 2000000 / (cpus + 1) + 10;
+	size_t len;
+	stat_bench b;
+	char name[64];
+
+	b.cpus = cpus;
+	b.image = make_stat(cpus, &len);
+	b.old = calloc(cpus + 1, sizeof(*b.old));
+	b.load = calloc(cpus, sizeof(unsigned int));
+	b.fp = fmemopen(b.image, len, "r");
+	if (cpu_ticks_alloc(&b.ticks, cpus) < 0 || !b.old || !b.load || !b.fp)
+		exit(1);
+
+	snprintf(name, sizeof(name), "/proc/stat sscanf, %u cpus", cpus);
+	bench_run(name, op_stat_sscanf, &b, iters);
+
+	snprintf(name, sizeof(name), "/proc/stat stat_parse, %u cpus", cpus);
+	bench_run(name, op_stat_parse, &b, iters);
+	if (!ticks_equal(b.old, &b.ticks, cpus))
+		fprintf(stderr, "stat_parse: result differs from sscanf "
+		    "for %u CPUs\n", cpus);
+
+	check_load_math(&b);
+	snprintf(name, sizeof(name), "load math float, %u cpus", cpus);
+	bench_run(name, op_load_float, &b, iters);
+	snprintf(name, sizeof(name), "load math, %u cpus", cpus);
+	bench_run(name, op_load_math, &b, iters);
+
+	fclose(b.fp);
+	free(b.image);
+	cpu_ticks_free(&b.ticks);
+	free(b.old);
+	free(b.load);
+}
+
+/*###### Sampling from the fixtures #####################################*/
+
+static void op_mem_snapshot(void *arg)
+{
+	mem_snapshot snap;
+
+	(void)arg;
+	Get_Mem_Snapshot(&snap);
+}
+
+static void op_cpu_load(void *arg)
+{
+	stat_bench *b = arg;
+
+	Get_CPU_Load(b->load, b->cpus);
+}
+
+static void bench_fixtures(const char *dir)
+{
+	stat_bench b;
+	char name[64];
+
+	Sysinfo_Setup(dir, NULL, NULL, 1);
+	b.cpus = NumCpus_DoInit();
+	if (!(b.load = calloc(b.cpus, sizeof(unsigned int))))
+		exit(1);
+
+	bench_run("meminfo read+parse", op_mem_snapshot, NULL, 200000);
+	snprintf(name, sizeof(name), "Get_CPU_Load, %u cpus", b.cpus);
+	bench_run(name, op_cpu_load, &b, 200000);
+
+	Sysinfo_Close();
+	free(b.load);
+}
+
+/*###### Drawing ########################################################*/
+
+/* The samples of a recorded capture, drawn into the frame buffer one
+ * after the other and over again, without an X server */
+typedef struct render_bench {
+	history h;
+	graph g;
+	unsigned int cpus;
+	unsigned int count;          /* samples recorded */
+	unsigned int next;           /* sample drawn next */
+	unsigned int *load;          /* 'cpus' loads per sample */
+	unsigned char *val;          /* 'h.series' history values per sample */
+	unsigned long long ts, step; /* history time, recorded sample step */
+	int style;
+	unsigned long frames, pixels; /* frames drawn, pixels they damaged */
+} render_bench;
+
+/* reads every sample of the capture 'path' through the sampler, and
+ * turns it into history values as wmSMPmon.c does */
+static void render_load(render_bench *r, const char *path)
+{
+	unsigned long long first = 0, last = 0;
+	unsigned int j, size = 64, sum, series;
+	mem_snapshot mem;
+	sched_snapshot sched;
+	unsigned char *v;
+
+	Sysinfo_Setup(NULL, NULL, path, 0);
+	r->cpus = NumCpus_DoInit();
+	series = HIST_CPU0 + r->cpus;
+	r->load = malloc(size * r->cpus * sizeof(*r->load));
+	r->val = malloc(size * series);
+	if (!r->load || !r->val)
+		exit(1);
+
+	/* the end of a replay raises SIGTERM */
+	signal(SIGTERM, SIG_IGN);
+	/* the first loads are those since boot */
+	Get_CPU_Load(r->load, r->cpus);
+	for (r->count = 0; ; r->count++) {
+		if (r->count == size) {
+			size *= 2;
+			r->load = realloc(r->load,
+			    size * r->cpus * sizeof(*r->load));
+			r->val = realloc(r->val, size * series);
+			if (!r->load || !r->val)
+				exit(1);
+		}
+		Get_CPU_Load(r->load + r->count * r->cpus, r->cpus);
+		if (!Sysinfo_Paced())
+			break;
+		if (!r->count)
+			first = Get_CPU_Time();
+		last = Get_CPU_Time();
+		Get_Mem_Snapshot(&mem);
+		Get_Sched_Snapshot(&sched);
+
+		v = r->val + r->count * series;
+		memset(v, 0, series);
+		for (j = sum = 0; j < r->cpus; j++) {
+			sum += r->load[r->count * r->cpus + j];
+			v[HIST_CPU0 + j] = r->load[r->count * r->cpus + j];
+		}
+		v[HIST_ALL] = sum / r->cpus;
+		v[HIST_RAM] = mem.mem * HEIGHT / 100;
+		v[HIST_CACHE] = mem.mem2 * HEIGHT / 100;
+		v[HIST_SWAP] = mem.swap == 999 ? 0 : mem.swap * HEIGHT / 100;
+		v[HIST_RUNQ] = sched.running >= 2U * r->cpus ? HEIGHT :
+		    sched.running * HEIGHT / (2 * r->cpus);
+	}
+	Sysinfo_Close();
+	signal(SIGTERM, SIG_DFL);
+	if (r->count < 2) {
+		fprintf(stderr, "%s: too few samples to draw\n", path);
+		exit(1);
+	}
+	r->step = (last - first) / (r->count - 1) + 1;
+}
+
+/* the common frame: the next sample, which ends one history row and
+ * so adds one column to the graph */
+static void op_render_sample(void *arg)
+{
+	render_bench *r = arg;
+	unsigned int k = r->next++ % r->count, cols;
+
+	r->ts += r->step;
+	cols = history_add(&r->h, r->ts, r->val + k * r->h.series, HIST_RAW);
+	bars_draw(r->load + k * r->cpus, r->cpus);
+	if (cols >= WIDTH_T) {
+		graph_draw(&r->g, r->style, 0);
+	} else if (cols) {
+		graph_scroll(cols);
+		graph_draw(&r->g, r->style, WIDTH_T - cols);
+	}
+	r->pixels += TakeDamage();
+	r->frames++;
+}
+
+/* a full repaint of the graph, e.g. after a style change */
+static void op_render_full(void *arg)
+{
+	render_bench *r = arg;
+
+	graph_draw(&r->g, r->style, 0);
+	r->pixels += TakeDamage();
+	r->frames++;
+}
+
+static void bench_render(const char *dir)
+{
+	render_bench r;
+	char name[64], path[PATH_MAX];
+	int style;
+
+	snprintf(path, sizeof(path), "%s/render.cap", dir);
+	render_load(&r, path);
+	openFrame(wmSMPmon_master_xpm);
+
+	history_init(&r.h, r.cpus, r.step, NULL);
+	r.ts = 0;
+	r.next = 0;
+	r.g.h = &r.h;
+	r.g.cpus = r.cpus;
+	r.g.tier = HIST_RAW;
+	r.g.draw_mem = 1;
+	r.g.view = VIEW_NONE;
+	r.g.draw_sched = 1;
+
+	/* the styles wmSMPmon offers for this many CPUs */
+	for (style = 1; style <= STYLE_MAX; style++) {
+		if (style > 1 && (r.cpus == 1 ||
+		    (r.cpus > 2 && style != STYLE_HEATMAP)))
+			continue;
+		r.style = style;
+		r.frames = r.pixels = 0;
+		snprintf(name, sizeof(name), "frame, %u cpus, style %d",
+		    r.cpus, style);
+		bench_run(name, op_render_sample, &r, 20000);
+		printf("%-36s %12.1f\n", "  pixels sent per frame",
+		    (double)r.pixels / r.frames);
+		r.frames = r.pixels = 0;
+		snprintf(name, sizeof(name), "graph repaint, style %d", style);
+		bench_run(name, op_render_full, &r, 20000);
+		printf("%-36s %12.1f\n", "  pixels sent per frame",
+		    (double)r.pixels / r.frames);
+	}
+	free(r.load);
+	free(r.val);
+	history_free(&r.h);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	cycles_open();
+	printf("%-36s %12s %10s %12s\n", "benchmark", "ns/op", "allocs/op",
+	    cycles_tsc ? "tsc/op" : "cycles/op");
+	for (i = 0; i < sizeof(bench_cpus) / sizeof(bench_cpus[0]); i++)
+		bench_stat(bench_cpus[i]);
+	bench_fixtures(argc > 1 ? argv[1] : FIXTURES);
+	bench_render(argc > 1 ? argv[1] : FIXTURES);
+	return 0;
+}
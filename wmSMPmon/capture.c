@@ -0,0 +1,224 @@
+/*######################################################################
+  #                                                                    #
+  # Record/replay of the raw /proc and /sys files, see capture.h.      #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+#include "standards.h"
+
+/* longest pause taken when replaying, e.g. between appended sessions */
+#define MAX_GAP_NS 10000000000ULL
+
+typedef struct cap_header {
+	char magic[8];
+	uint32_t cpus;
+	uint32_t reserved;
+} cap_header;
+
+typedef struct cap_record {
+	uint64_t ts;
+	uint8_t id;
+	uint8_t reserved[3];
+	uint32_t len;
+} cap_record;
+
+static FILE *rec_fp;
+
+static const char *map;		/* the capture being replayed */
+static size_t map_len;
+static size_t cursor[PROC_FILES]; /* next record to look at, per file */
+static uint64_t replay_ts;	/* time of the current /proc/stat record */
+static uint64_t replay_end;	/* time of the next one */
+static double replay_speed;
+static int replay_ended;
+
+int capture_record_open(const char *path, unsigned int cpus)
+{
+	cap_header h;
+
+	if (!(rec_fp = fopen(path, "a+b")))
+		return -1;
+	if (fread(&h, sizeof(h), 1, rec_fp) == 1) {
+		if (memcmp(h.magic, CAPTURE_MAGIC, 8) || h.cpus != cpus) {
+			fprintf(stderr, "%s is not a capture of %u CPUs\n",
+			    path, cpus);
+			fclose(rec_fp);
+			rec_fp = NULL;
+			return -1;
+		}
+	} else {
+		memcpy(h.magic, CAPTURE_MAGIC, 8);
+		h.cpus = cpus;
+		h.reserved = 0;
+		if (fwrite(&h, sizeof(h), 1, rec_fp) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+void capture_record(const proc_file *f)
+{
+	cap_record r = { f->ts, f->id, { 0, 0, 0 }, f->len };
+
+	fwrite(&r, sizeof(r), 1, rec_fp);
+	fwrite(f->buf, 1, f->len, rec_fp);
+	/* one flush per sampling round */
+	if (f->id == PROC_STAT)
+		fflush(rec_fp);
+}
+
+int capture_replay_open(const char *path, double speed, unsigned int *cpus)
+{
+	struct stat st;
+	cap_header h;
+	int fd, i;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(h)) {
+		close(fd);
+		return -1;
+	}
+	map_len = st.st_size;
+	map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return -1;
+	}
+	memcpy(&h, map, sizeof(h));
+	if (memcmp(h.magic, CAPTURE_MAGIC, 8) || !h.cpus) {
+		fprintf(stderr, "%s is not a capture file\n", path);
+		capture_close();
+		return -1;
+	}
+	for (i = 0; i < PROC_FILES; i++)
+		cursor[i] = sizeof(h);
+	*cpus = h.cpus;
+	replay_speed = speed;
+	return 0;
+}
+
+int capture_recording(void)
+{
+	return rec_fp != NULL;
+}
+
+int capture_replaying(void)
+{
+	return map != NULL;
+}
+
+int capture_replay_ended(void)
+{
+	return replay_ended;
+}
+
+/* Returns the offset of the first record for 'id' at or after 'pos',
+   or 0 if there is none */
+static size_t next_record(size_t pos, unsigned int id)
+{
+	cap_record r;
+
+	while (pos + sizeof(r) <= map_len) {
+		memcpy(&r, map + pos, sizeof(r));
+		if (pos + sizeof(r) + r.len > map_len)
+			break; /* truncated by a crash while recording */
+		if (r.id == id)
+			return pos;
+		pos += sizeof(r) + r.len;
+	}
+	return 0;
+}
+
+/* waits for the recorded time between two /proc/stat reads */
+static void replay_pace(uint64_t ts)
+{
+	unsigned long long gap;
+	struct timespec ts_wait;
+
+	if (replay_ts && replay_speed > 0 && ts > replay_ts) {
+		gap = ts - replay_ts;
+		if (gap > MAX_GAP_NS)
+			gap = MAX_GAP_NS;
+		gap /= replay_speed;
+		ts_wait.tv_sec = gap / 1000000000ULL;
+		ts_wait.tv_nsec = gap % 1000000000ULL;
+		while (nanosleep(&ts_wait, &ts_wait) < 0 && errno == EINTR)
+			;
+	}
+	replay_ts = ts;
+}
+
+ssize_t capture_replay(proc_file *f)
+{
+	cap_record r;
+	size_t pos, next;
+
+	pos = next_record(cursor[f->id], f->id);
+	if (!pos) {
+		if (f->id == PROC_STAT && !replay_ended) {
+			fprintf(stderr, "End of replay\n");
+			kill(getpid(), SIGTERM);
+			replay_ended = 1;
+		}
+		return -1;
+	}
+	memcpy(&r, map + pos, sizeof(r));
+	if (f->id == PROC_STAT) {
+		replay_pace(r.ts);
+		cursor[f->id] = pos + sizeof(r) + r.len;
+		replay_end = UINT64_MAX;
+		if ((next = next_record(cursor[f->id], f->id)))
+			memcpy(&replay_end, map + next, sizeof(replay_end));
+	} else {
+		/* the latest record read before the next /proc/stat */
+		while ((next = next_record(pos + sizeof(r) + r.len, f->id))) {
+			cap_record n;
+
+			memcpy(&n, map + next, sizeof(n));
+			if (n.ts >= replay_end)
+				break;
+			pos = next;
+			r = n;
+		}
+		cursor[f->id] = pos;
+	}
+
+	if (r.len > f->size) {
+		f->size = r.len;
+		if (!(f->buf = realloc(f->buf, f->size + STAT_PAD))) {
+			fprintf(stderr, "Failed to allocate buffer for %s\n",
+			    f->path);
+			exit(1);
+		}
+	}
+	memcpy(f->buf, map + pos + sizeof(r), r.len);
+	memset(f->buf + r.len, 0, STAT_PAD);
+	f->ts = r.ts;
+	return f->len = r.len;
+}
+
+void capture_close(void)
+{
+	if (rec_fp)
+		fclose(rec_fp);
+	rec_fp = NULL;
+	if (map)
+		munmap((void *)map, map_len);
+	map = NULL;
+}
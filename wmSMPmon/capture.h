@@ -0,0 +1,51 @@
+/*######################################################################
+  #                                                                    #
+  # Record/replay of the raw /proc and /sys files read by the Linux    #
+  # sampler, see sysinfo-linux.c.                                      #
+  #                                                                    #
+  # A capture file starts with the 8 bytes "WSMPCAP1", followed by the #
+  # number of CPUs as u32 and 4 reserved bytes. Every read adds one    #
+  # record: u64 CLOCK_MONOTONIC ns, u8 file id (PROC_xxx), 3 reserved  #
+  # bytes, u32 length, then the file contents. Integers are in host    #
+  # byte order. Captures are only ever appended to.                    #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifndef WMSMP_CAPTURE_H
+#define WMSMP_CAPTURE_H
+
+#include "sysinfo-linux.h"
+
+#define CAPTURE_MAGIC "WSMPCAP1"
+
+/* Appends every file read to 'path', which is created if needed. An
+   existing capture must be for 'cpus' CPUs. Returns -1 on errors. */
+int capture_record_open(const char *path, unsigned int cpus);
+
+/* Serves reads from the capture 'path' instead of the system, paced at
+   'speed' times the recorded rate (0: as fast as possible). The number
+   of CPUs recorded is stored in '*cpus'. Returns -1 on errors. */
+int capture_replay_open(const char *path, double speed, unsigned int *cpus);
+
+int capture_recording(void);
+int capture_replaying(void);
+/* true once the replay has run out of /proc/stat records */
+int capture_replay_ended(void);
+
+/* Recording: appends the contents of 'f' after a read */
+void capture_record(const proc_file *f);
+
+/* Replay: fills 'f' with its next recorded contents like
+   proc_file_read(). /proc/stat is read once per sampling round and
+   sets the pace; other files return their latest contents recorded up
+   to that point. At the end of the capture the program is sent SIGTERM,
+   once, and -1 is returned. */
+ssize_t capture_replay(proc_file *f);
+
+void capture_close(void);
+
+#endif /* WMSMP_CAPTURE_H */
@@ -0,0 +1,284 @@
+/*######################################################################
+  #                                                                    #
+  # Background sampler thread, see collector.h.                        #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#include "collector.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Waits for the next deadline and returns the number of periods that
+ * passed, more than one if we were late. The deadlines are absolute,
+ * so the time spent sampling does not add up to drift. Without timerfd
+ * (e.g. on Solaris) the thread sleeps until the deadline itself. */
+static unsigned long long timer_wait(collector *c)
+{
+	unsigned long long ticks = 1;
+#ifdef HAVE_SYS_TIMERFD_H
+
+	while (read(c->timer_fd, &ticks, sizeof(ticks)) < 0 &&
+	    errno == EINTR)
+		;
+#else
+	unsigned long long next, period, now;
+	struct timespec ts;
+
+	next = atomic_load(&c->next);
+	ts.tv_sec = next / NSEC_PER_SEC;
+	ts.tv_nsec = next % NSEC_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	    == EINTR)
+		;
+	period = atomic_load(&c->period);
+	now = monotonic_ns();
+	if (now > next)
+		ticks = 1 + (now - next) / period;
+	/* unless collector_set_period moved the deadline meanwhile */
+	atomic_compare_exchange_strong(&c->next, &next,
+	    next + ticks * period);
+#endif
+	return ticks;
+}
+
+static void *collector_main(void *arg)
+{
+	collector *c = arg;
+	unsigned long long ticks, one = 1, period, replayed;
+	unsigned int round = 0, head, tail;
+	int paced, was_paced = 0;
+	struct timespec ts;
+	sample *s;
+
+	while (atomic_load_explicit(&c->running, memory_order_relaxed)) {
+		paced = Sysinfo_Paced();
+		head = atomic_load_explicit(&c->head, memory_order_relaxed);
+		tail = atomic_load_explicit(&c->tail, memory_order_acquire);
+		if (head - tail < RING_SIZE) {
+			s = &c->ring[head & (RING_SIZE - 1)];
+			s->ts = monotonic_ns();
+			Get_CPU_Load(s->load, c->cpus);
+			Get_CPU_Busy(s->busy, c->cpus);
+			if ((replayed = Get_CPU_Time()))
+				s->ts = replayed;
+			s->has_mem = (round % atomic_load_explicit(&c->mem_every,
+			    memory_order_relaxed) == 0);
+			if (s->has_mem) {
+				Get_Mem_Snapshot(&s->mem);
+				Get_View_Snapshot(&s->view);
+				Get_Sched_Snapshot(&s->sched);
+			}
+			/* publish the slot and wake the renderer, early if
+			   the ring is half full */
+			atomic_store_explicit(&c->head, head + 1,
+			    memory_order_release);
+			if ((round + 1) % atomic_load_explicit(&c->wake_every,
+			    memory_order_relaxed) == 0 ||
+			    head + 1 - tail >= RING_SIZE / 2) {
+				if (write(c->wake_wr, &one, sizeof(one)) < 0) {
+					/* counter overflow or pipe full: it
+					   is awake anyway */
+				}
+			}
+		} else if (paced) {
+			/* a replay waits for the renderer rather than skip
+			   records */
+			period = atomic_load(&c->period);
+			ts.tv_sec = period / NSEC_PER_SEC;
+			ts.tv_nsec = period % NSEC_PER_SEC;
+			nanosleep(&ts, NULL);
+			continue;
+		} else {
+			/* the renderer is stalled, don't block on it */
+			atomic_fetch_add_explicit(&c->dropped, 1,
+			    memory_order_relaxed);
+		}
+		round++;
+
+		/* a replay sleeps in its reads, at its own speed */
+		if (paced) {
+			was_paced = 1;
+			continue;
+		}
+		/* expirations beyond one mean we were late and rounds
+		   were skipped, unless they passed during a replay */
+		ticks = timer_wait(c);
+		if (ticks > 1 && !was_paced)
+			atomic_fetch_add_explicit(&c->late, ticks - 1,
+			    memory_order_relaxed);
+		was_paced = 0;
+	}
+	return NULL;
+}
+
+int collector_set_period(collector *c, unsigned long period_us,
+    unsigned int mem_every, unsigned int wake_every)
+{
+	unsigned long long period = period_us ? period_us * 1000ULL : 1000;
+	unsigned long long start;
+#ifdef HAVE_SYS_TIMERFD_H
+	struct itimerspec its;
+#endif
+
+	atomic_store(&c->period, period);
+	atomic_store_explicit(&c->mem_every, mem_every ? mem_every : 1,
+	    memory_order_relaxed);
+	atomic_store_explicit(&c->wake_every, wake_every ? wake_every : 1,
+	    memory_order_relaxed);
+	/* first expiry one period from now, then every period */
+	start = monotonic_ns() + period;
+	atomic_store(&c->next, start);
+#ifdef HAVE_SYS_TIMERFD_H
+	its.it_value.tv_sec = start / NSEC_PER_SEC;
+	its.it_value.tv_nsec = start % NSEC_PER_SEC;
+	its.it_interval.tv_sec = period / NSEC_PER_SEC;
+	its.it_interval.tv_nsec = period % NSEC_PER_SEC;
+	return timerfd_settime(c->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+#else
+	return 0;
+#endif
+}
+
+/* The renderer polls wake_fd: an eventfd, or the read end of a pipe
+ * where there is none. Both ends are non-blocking. Returns -1 on
+ * errors. */
+static int wake_open(collector *c)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	c->wake_fd = c->wake_wr = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return c->wake_fd == -1 ? -1 : 0;
+#else
+	int fd[2], i;
+
+	if (pipe(fd) < 0)
+		return -1;
+	for (i = 0; i < 2; i++) {
+		fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+		fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+	}
+	c->wake_fd = fd[0];
+	c->wake_wr = fd[1];
+	return 0;
+#endif
+}
+
+int collector_start(collector *c, unsigned int cpus,
+    unsigned long period_us, unsigned int mem_every,
+    unsigned int wake_every)
+{
+	sigset_t all, old;
+	unsigned int i;
+	int rc;
+
+	c->cpus = cpus;
+	atomic_init(&c->mem_every, 1);
+	atomic_init(&c->wake_every, 1);
+	atomic_init(&c->head, 0);
+	atomic_init(&c->tail, 0);
+	atomic_init(&c->dropped, 0);
+	atomic_init(&c->late, 0);
+	atomic_init(&c->running, 1);
+	atomic_init(&c->period, 0);
+	atomic_init(&c->next, 0);
+
+#ifdef HAVE_SYS_TIMERFD_H
+	c->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#else
+	c->timer_fd = -1;
+#endif
+	if (wake_open(c) < 0 ||
+#ifdef HAVE_SYS_TIMERFD_H
+	    c->timer_fd == -1 ||
+#endif
+	    collector_set_period(c, period_us, mem_every, wake_every) < 0)
+		return -1;
+
+	for (i = 0; i < RING_SIZE; i++) {
+		c->ring[i].load = calloc(cpus, sizeof(unsigned int));
+		c->ring[i].busy = calloc(cpus, sizeof(unsigned int));
+		if (!c->ring[i].load || !c->ring[i].busy) {
+			fprintf(stderr, "Failed to allocate sample ring\n");
+			exit(1);
+		}
+	}
+	/* signals are left to the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(&c->thread, NULL, collector_main, c);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc) {
+		atomic_store(&c->running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+const sample *collector_peek(collector *c)
+{
+	unsigned int tail = atomic_load_explicit(&c->tail, memory_order_relaxed);
+
+	if (tail == atomic_load_explicit(&c->head, memory_order_acquire))
+		return NULL;
+	return &c->ring[tail & (RING_SIZE - 1)];
+}
+
+void collector_release(collector *c)
+{
+	atomic_fetch_add_explicit(&c->tail, 1, memory_order_release);
+}
+
+void collector_ack(collector *c)
+{
+	unsigned long long n;
+
+	/* one read resets an eventfd, a pipe may hold several wakeups;
+	   EAGAIN once nothing is pending */
+	while (read(c->wake_fd, &n, sizeof(n)) > 0 &&
+	    c->wake_wr != c->wake_fd)
+		;
+}
+
+void collector_stop(collector *c)
+{
+	unsigned int i;
+
+	if (!atomic_exchange(&c->running, 0))
+		return;
+	pthread_join(c->thread, NULL);
+	if (c->timer_fd != -1)
+		close(c->timer_fd);
+	if (c->wake_wr != c->wake_fd)
+		close(c->wake_wr);
+	close(c->wake_fd);
+	for (i = 0; i < RING_SIZE; i++) {
+		free(c->ring[i].load);
+		free(c->ring[i].busy);
+		c->ring[i].load = c->ring[i].busy = NULL;
+	}
+}
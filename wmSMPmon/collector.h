@@ -0,0 +1,81 @@
+/*######################################################################
+  #                                                                    #
+  # Background sampler thread. It calls the sysinfo-XXX module on a    #
+  # timerfd with absolute deadlines and hands timestamped samples to   #
+  # the renderer over a lock-free single-producer/single-consumer      #
+  # ring. An eventfd wakes the renderer's poll() loop.                 #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifndef WMSMP_COLLECTOR_H
+#define WMSMP_COLLECTOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "standards.h"
+
+/* number of samples the renderer may fall behind, must be a power of 2 */
+#define RING_SIZE 256
+
+/* One sampling round */
+typedef struct sample {
+	unsigned long long ts;  /* CLOCK_MONOTONIC time of the sample, in ns,
+	                           the recorded one in a replay */
+	unsigned int *load;     /* per-CPU load scaled to HEIGHT, 'cpus' long */
+	unsigned int *busy;     /* the same in 1/1000, unrounded */
+	int has_mem;            /* 'mem', 'view' and 'sched' were sampled */
+	mem_snapshot mem;
+	view_snapshot view;
+	sched_snapshot sched;
+} sample;
+
+typedef struct collector {
+	sample ring[RING_SIZE];
+	atomic_uint head;       /* next slot written by the sampler thread */
+	atomic_uint tail;       /* next slot read by the renderer */
+	atomic_uint dropped;    /* samples lost because the ring was full */
+	atomic_uint late;       /* rounds skipped because sampling overran */
+	atomic_int running;
+	int timer_fd;           /* sampling cadence, -1 without timerfd */
+	int wake_fd;            /* readable when samples were published */
+	int wake_wr;            /* written to wake the renderer */
+	unsigned int cpus;
+	atomic_ullong period;   /* ns between two samples */
+	atomic_ullong next;     /* next deadline, without timerfd */
+	atomic_uint mem_every;  /* sample memory every n-th round */
+	atomic_uint wake_every; /* wake the renderer every n-th round */
+	pthread_t thread;
+} collector;
+
+/* Starts sampling 'cpus' CPUs every 'period_us' microseconds, memory
+   every 'mem_every' samples starting with the first. The renderer is
+   woken every 'wake_every' samples, or earlier if the ring fills up.
+   A replay sets its own pace instead, see Sysinfo_Paced. NumCpus_DoInit
+   must have been called. Returns -1 if the thread can't be started. */
+int collector_start(collector *c, unsigned int cpus,
+    unsigned long period_us, unsigned int mem_every,
+    unsigned int wake_every);
+
+/* Changes the sampling rate, the next sample is taken one period from
+   now. Called from the renderer, e.g. to slow down while hidden. */
+int collector_set_period(collector *c, unsigned long period_us,
+    unsigned int mem_every, unsigned int wake_every);
+
+/* Renderer side: collector_peek returns the oldest unread sample or
+   NULL if there is none; collector_release hands its slot back.
+   Poll wake_fd for input and call collector_ack before draining. */
+const sample *collector_peek(collector *c);
+void collector_release(collector *c);
+void collector_ack(collector *c);
+
+/* Stops and joins the sampler thread */
+void collector_stop(collector *c);
+
+/* CLOCK_MONOTONIC in ns */
+unsigned long long monotonic_ns(void);
+
+#endif /* WMSMP_COLLECTOR_H */
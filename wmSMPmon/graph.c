@@ -0,0 +1,223 @@
+/*######################################################################
+  #                                                                    #
+  # Drawing of the load bars and the history graph, see graph.h.       #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include	<string.h>
+#include	<X11/Xlib.h>
+#include	<X11/xpm.h>
+#include	"wmgeneral.h"
+#include	"graph.h"
+
+/*###### Heatmap ########################################################*/
+/* Paints graph column x of the heatmap from history slot idx. Each pixel
+ * row band is one CPU or, with more CPUs than rows, a bucket of CPUs shown
+ * at the load of its busiest member. Colors are taken from the memory bar
+ * gradient (green -> red); idle cells keep the background. */
+static void draw_heat_column(const unsigned char *tcpu, unsigned int cpus,
+    unsigned int idx, int x)
+{
+	unsigned int	rows = cpus < HEIGHT ? cpus : HEIGHT,
+			row_h = HEIGHT / rows,
+			r, c, last, load;
+	int		color, run_color = -1,
+			run_y = 0, run_h = 0, y;
+
+	copyXPMArea(64, 32, 1, HEIGHT, x, 5);
+	for (r = 0; r <= rows; r++) {
+		color = -1;
+		if (r < rows) {
+			load = 0;
+			last = (r + 1) * cpus / rows;
+			for (c = r * cpus / rows; c < last; c++) {
+				if (tcpu[c * WIDTH_T + idx] > load)
+					load = tcpu[c * WIDTH_T + idx];
+			}
+			if (load > 1)
+				color = (load - 1) * 29 / (HEIGHT - 1);
+		}
+		if (color == run_color && r < rows) {
+			run_h += row_h;
+			continue;
+		}
+		/* flush the run; the gradient strip is only 8 pixels high */
+		for (y = run_y; run_color >= 0 && y < run_y + run_h; y += 8) {
+			copyXPMArea(run_color, 63, 1,
+			    run_y + run_h - y < 8 ? run_y + run_h - y : 8, x, 5 + y);
+		}
+		run_color = color;
+		run_y = r * row_h;
+		run_h = row_h;
+	}
+}
+
+/*###### Graph ##########################################################*/
+/* Peaks are drawn as single pixels in the dark graph color */
+#define PEAK_X 117
+#define PEAK_Y 13
+/* the run queue line, white, and bright red when saturated */
+#define RUNQ_X 68
+#define RUNQ_Y 74
+#define RUNQ_HOT_X 23
+#define RUNQ_HOT_Y 71
+
+/* the highest load any CPU reached in history slot idx */
+static unsigned int busiest_peak(const unsigned char *tcpu_max,
+    unsigned int cpus, unsigned int idx)
+{
+	unsigned int c, peak = 0;
+
+	for (c = 0; c < cpus; c++)
+		if (tcpu_max[c * WIDTH_T + idx] > peak)
+			peak = tcpu_max[c * WIDTH_T + idx];
+	return peak;
+}
+
+void graph_scroll(unsigned int n)
+{
+	copyXPMArea(15 + n, 5, WIDTH_T - n, HEIGHT, 15, 5);
+}
+
+void graph_draw(const graph *g, int style, unsigned int first)
+{
+	const unsigned char
+			*tcpu = history_series(g->h, g->tier, HIST_MEAN, HIST_CPU0),
+			*tpeak = history_series(g->h, g->tier, HIST_MAX, HIST_CPU0),
+			*tm = history_series(g->h, g->tier, HIST_MEAN, HIST_ALL),
+			*tram = history_series(g->h, g->tier, HIST_MEAN, HIST_RAM),
+			*tcache = history_series(g->h, g->tier, HIST_MEAN, HIST_CACHE),
+			*tswap = history_series(g->h, g->tier, HIST_MEAN, HIST_SWAP),
+			*tview = history_series(g->h, g->tier, HIST_MEAN, HIST_VIEW),
+			*trunq = history_series(g->h, g->tier, HIST_MEAN, HIST_RUNQ);
+	/* pixels of the view lines: red, yellow, blue */
+	static const unsigned int view_y[VIEW_LINES] = { 71, 73, 72 };
+#ifdef HAVE_NVIDIA
+	const unsigned char
+			*tgpu = history_series(g->h, g->tier, HIST_MEAN, HIST_GPU);
+#endif
+	unsigned int i, j, k, delta, peak;
+
+	for (i = first; i < WIDTH_T; i++) {
+		j = (g->h->tier[g->tier].idx + i) % WIDTH_T;
+		switch (style) {
+		case 1 :
+			copyXPMArea(64, 32, 1, HEIGHT, 15 + i, 5);
+			copyXPMArea(116, 0, 1, tm[j], 15 + i, HEIGHT + 5 - tm[j]);
+			/* above the mean, the peak of the busiest CPU */
+			peak = busiest_peak(tpeak, g->cpus, j);
+			if (peak > tm[j])
+				copyXPMArea(PEAK_X, PEAK_Y, 1, 1, 15 + i, HEIGHT + 5 - peak);
+			if (g->view) {
+				for (k = 0; k < VIEW_LINES; k++)
+					if (tview[k * WIDTH_T + j] != 0)
+						copyXPMArea(68, view_y[k], 1, 1, 15 + i,
+						    HEIGHT + 5 - tview[k * WIDTH_T + j]);
+			} else if (g->draw_mem) {
+				if (tram[j] != 0) copyXPMArea(68, 73, 1, 1, 15 + i, HEIGHT + 5 - tram[j]);
+				if (tcache[j] != 0) copyXPMArea(68, 72, 1, 1, 15 + i, HEIGHT + 5 - tcache[j]);
+				if (tswap[j] != 0 ) copyXPMArea(68, 71, 1, 1, 15 + i, HEIGHT + 5 - tswap[j]);
+#ifdef HAVE_NVIDIA
+				if (tgpu[j] != 0 ) copyXPMArea(68, 74, 1, 1, 15 + i, HEIGHT + 5 - tgpu[j]);
+#endif
+			}
+			/* more runnable tasks than CPUs: above mid-height, red */
+			if (g->draw_sched && trunq[j] != 0)
+				copyXPMArea(trunq[j] > HEIGHT / 2 ? RUNQ_HOT_X : RUNQ_X,
+				    trunq[j] > HEIGHT / 2 ? RUNQ_HOT_Y : RUNQ_Y,
+				    1, 1, 15 + i, HEIGHT + 5 - trunq[j]);
+			break;
+		case 2 :
+			copyXPMArea(64, 0, 1, HEIGHT, 15 + i, 5);
+			delta = tcpu[j] / 2;
+			copyXPMArea(116, 0, 1, delta, 15 + i, HEIGHT/2 + 5 - delta);
+			if ((peak = tpeak[j] / 2) > delta)
+				copyXPMArea(PEAK_X, PEAK_Y, 1, 1, 15 + i, HEIGHT/2 + 5 - peak);
+			delta = tcpu[WIDTH_T + j] / 2;
+			copyXPMArea(116, 0, 1, delta, 15 + i, HEIGHT/2 + 21 - delta);
+			if ((peak = tpeak[WIDTH_T + j] / 2) > delta)
+				copyXPMArea(PEAK_X, PEAK_Y, 1, 1, 15 + i, HEIGHT/2 + 21 - peak);
+			break;
+		case 3 :
+			copyXPMArea(64, 0, 1, HEIGHT, 15 + i, 5);
+			delta = tcpu[j] / 2;
+			copyXPMArea(116, 0, 1, delta, 15 + i, HEIGHT/2 + 5 - delta);
+			if ((peak = tpeak[j] / 2) > delta)
+				copyXPMArea(PEAK_X, PEAK_Y, 1, 1, 15 + i, HEIGHT/2 + 5 - peak);
+			delta = tcpu[WIDTH_T + j] / 2;
+			copyXPMArea(117, HEIGHT/2 - delta, 1, delta, 15 + i, HEIGHT/2 + 6);
+			if ((peak = tpeak[WIDTH_T + j] / 2) > delta)
+				copyXPMArea(PEAK_X, PEAK_Y, 1, 1, 15 + i, HEIGHT/2 + 5 + peak);
+			break;
+		case STYLE_HEATMAP :
+			draw_heat_column(tcpu, g->cpus, j, 15 + i);
+			break;
+		}
+	}
+}
+
+/*###### Load bars ######################################################*/
+/* mean and maximum each bar was last drawn with, so that unchanged bars
+ * are left alone */
+static unsigned int bar_last[BAR_WIDTH][2];
+static int bars_shown;
+
+void bars_draw(const unsigned int *load, unsigned int cpus)
+{
+	unsigned int	load_width, /* width of load bar: 3 for SMP, 8 for UP */
+			bar_cpus, /* number of CPUs folded into one load bar */
+			bar_count, /* number of load bars drawn */
+			offset = 0,
+			i, j, sum, max_load, delta;
+
+	if (cpus == 1) {
+		load_width = 8;
+	} else if (cpus == 2) {
+		load_width = 3;
+	} else if (cpus == 4 || cpus == 3) {
+		load_width = 2;
+	} else {
+		load_width = 1;
+	}
+	/* more CPUs than pixels: fold neighbouring CPUs into one bar each,
+	 * showing the group's mean load plus a marker at its maximum */
+	bar_cpus = (cpus + BAR_WIDTH - 1) / BAR_WIDTH;
+	bar_count = (cpus + bar_cpus - 1) / bar_cpus;
+
+	for (i = 0; i < bar_count; i++) {
+		sum = 0;
+		max_load = 0;
+		for (j = i * bar_cpus; j < cpus && j < (i + 1) * bar_cpus; j++) {
+			sum += load[j];
+			if (load[j] > max_load)
+				max_load = load[j];
+		}
+		sum = sum / (j - i * bar_cpus);
+		delta = HEIGHT - sum;
+		if (cpus == 2 && i == 1) {
+			offset = 2;
+		}
+		if (bars_shown && bar_last[i][0] == sum &&
+		    bar_last[i][1] == max_load)
+			continue;
+		bar_last[i][0] = sum;
+		bar_last[i][1] = max_load;
+		copyXPMArea(108, 0, load_width, HEIGHT, 4 + i * load_width + offset, 5);
+		copyXPMArea(108, 32 + delta, load_width, sum,
+		    4 + i * load_width + offset, 5 + delta);
+		if (max_load > sum) {
+			/* mark the busiest CPU of the group */
+			copyXPMArea(108, 32 + HEIGHT - max_load,
+			    load_width, 1, 4 + i * load_width + offset,
+			    5 + HEIGHT - max_load);
+		}
+	}
+	bars_shown = 1;
+}
@@ -0,0 +1,45 @@
+/*######################################################################
+  #                                                                    #
+  # Drawing of the load bars and the history graph into the window    #
+  # pixmap, see wmgeneral.c. Kept apart from the main loop so that     #
+  # 'make bench' can time it.                                          #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifndef WMSMP_GRAPH_H
+#define WMSMP_GRAPH_H
+
+#include "standards.h"
+#include "history.h"
+
+/*###### Graph styles ###################################################*/
+#define STYLE_HEATMAP	4	/* per-CPU heatmap */
+#define STYLE_MAX	4
+
+/* What the graph shows: the mean of each row of one history tier,
+   oldest row on the left, with the peak load above it */
+typedef struct graph {
+	const history *h;
+	unsigned int cpus;
+	unsigned int tier;          /* timescale, HIST_xxx */
+	int draw_mem;               /* add the memory series to style 1 */
+	int view;                   /* VIEW_xxx, replaces the memory series */
+	int draw_sched;             /* add the run queue to style 1 */
+} graph;
+
+/* Paints graph columns 'first' to WIDTH_T - 1 in style 'style' */
+void graph_draw(const graph *g, int style, unsigned int first);
+
+/* Shifts the graph 'n' columns to the left, leaving the rightmost
+   'n' columns to be painted */
+void graph_scroll(unsigned int n);
+
+/* Paints the load bars for 'load', one value per CPU. Beyond
+   BAR_WIDTH CPUs, neighbouring CPUs share a bar. */
+void bars_draw(const unsigned int *load, unsigned int cpus);
+
+#endif /* WMSMP_GRAPH_H */
@@ -0,0 +1,146 @@
+/*######################################################################
+  #                                                                    #
+  # Headless mode, see headless.h.                                     #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <poll.h>
+#include "headless.h"
+
+/* stdio buffer, large enough for a few batches of 1024 CPU records */
+#define OUT_BUFSIZ (256 * 1024)
+
+static const char *format_names[] = { "csv", "json", "bin" };
+
+int headless_format(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (!strcmp(name, format_names[i]))
+			return i;
+	}
+	return -1;
+}
+
+static void put_le(FILE *out, unsigned long long v, int bytes)
+{
+	while (bytes--) {
+		putc(v & 0xff, out);
+		v >>= 8;
+	}
+}
+
+static void write_header(FILE *out, int fmt, unsigned int cpus)
+{
+	unsigned int i;
+
+	switch (fmt) {
+	case HEADLESS_CSV:
+		fputs("time_ns,mem,mem_cache,swap", out);
+		for (i = 0; i < cpus; i++)
+			fprintf(out, ",cpu%u", i);
+		putc('\n', out);
+		break;
+	case HEADLESS_BIN:
+		fputs(HEADLESS_MAGIC, out);
+		put_le(out, HEADLESS_VERSION, 4);
+		put_le(out, cpus, 4);
+		break;
+	}
+}
+
+static void write_sample(FILE *out, int fmt, unsigned int cpus,
+    const sample *s, const mem_snapshot *mem, const sched_snapshot *sc)
+{
+	unsigned int i;
+	int swap = mem->swap == 999 ? -1 : (int)mem->swap;
+
+	switch (fmt) {
+	case HEADLESS_CSV:
+		fprintf(out, "%llu,%u,%u,", s->ts, mem->mem, mem->mem2);
+		if (swap >= 0)
+			fprintf(out, "%d", swap);
+		for (i = 0; i < cpus; i++)
+			fprintf(out, ",%u.%u", s->busy[i] / 10,
+			    s->busy[i] % 10);
+		putc('\n', out);
+		break;
+	case HEADLESS_JSON:
+		fprintf(out, "{\"time_ns\":%llu,\"mem\":%u,\"mem_cache\":%u,"
+		    "\"swap\":", s->ts, mem->mem, mem->mem2);
+		if (swap >= 0)
+			fprintf(out, "%d", swap);
+		else
+			fputs("null", out);
+		fprintf(out, ",\"ctxt\":%u,\"intr\":%u,\"softirq\":%u,"
+		    "\"running\":%u,\"blocked\":%u,\"load1\":%u.%02u",
+		    sc->ctxt, sc->intr, sc->softirq, sc->running, sc->blocked,
+		    sc->load1 / 100, sc->load1 % 100);
+		fputs(",\"cpu\":[", out);
+		for (i = 0; i < cpus; i++)
+			fprintf(out, i ? ",%u.%u" : "%u.%u",
+			    s->busy[i] / 10, s->busy[i] % 10);
+		fputs("]}\n", out);
+		break;
+	case HEADLESS_BIN:
+		put_le(out, s->ts, 8);
+		putc(mem->mem, out);
+		putc(mem->mem2, out);
+		putc(swap >= 0 ? swap : 255, out);
+		putc(0, out);
+		for (i = 0; i < cpus; i++)
+			put_le(out, s->busy[i], 2);
+		break;
+	}
+}
+
+int headless_run(collector *c, FILE *out, int fmt, unsigned int batch,
+    volatile sig_atomic_t *stop)
+{
+	struct pollfd pfd;
+	mem_snapshot mem = { 0, 0, 999 };
+	sched_snapshot sched = { 0, 0, 0, 0, 0, 0 };
+	const sample *s;
+	unsigned int pending = 0;
+
+	/* writes go out in batches, not per sample */
+	setvbuf(out, NULL, _IOFBF, OUT_BUFSIZ);
+	write_header(out, fmt, c->cpus);
+
+	pfd.fd = c->wake_fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		collector_ack(c);
+		while ((s = collector_peek(c))) {
+			if (s->has_mem) {
+				mem = s->mem;
+				sched = s->sched;
+			}
+			write_sample(out, fmt, c->cpus, s, &mem, &sched);
+			collector_release(c);
+			if (++pending >= batch) {
+				if (fflush(out) == EOF)
+					return -1;
+				pending = 0;
+			}
+		}
+		if (ferror(out))
+			return -1;
+		/* the samples taken before 'stop', e.g. the whole of a
+		   fast replay, are written all the same */
+		if (*stop)
+			break;
+		poll(&pfd, 1, -1);
+	}
+	return fflush(out) == EOF ? -1 : 0;
+}
@@ -0,0 +1,40 @@
+/*######################################################################
+  #                                                                    #
+  # Headless mode: streams the samples of the collector to a file      #
+  # instead of drawing them, no X server needed.                       #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifndef WMSMP_HEADLESS_H
+#define WMSMP_HEADLESS_H
+
+#include <signal.h>
+#include "collector.h"
+
+/* Output formats */
+#define HEADLESS_CSV	0	/* header line, then one line per sample */
+#define HEADLESS_JSON	1	/* one JSON object per line */
+#define HEADLESS_BIN	2	/* see below */
+
+/* The binary format, all integers little endian:
+   header  "WSMP", u32 version (1), u32 number of CPUs
+   record  u64 CLOCK_MONOTONIC ns, u8 mem, u8 mem incl. caches,
+           u8 swap (255 = no swap), u8 reserved, u16 load per CPU
+   Percentages are 0-100, loads 0-1000. */
+#define HEADLESS_MAGIC		"WSMP"
+#define HEADLESS_VERSION	1
+
+/* Returns the HEADLESS_xxx format named 'name', -1 if there is none */
+int headless_format(const char *name);
+
+/* Writes every sample of 'c' to 'out' in format 'fmt' until '*stop' is
+   set, flushing every 'batch' samples. Returns 0, or -1 on write
+   errors. */
+int headless_run(collector *c, FILE *out, int fmt, unsigned int batch,
+    volatile sig_atomic_t *stop);
+
+#endif /* WMSMP_HEADLESS_H */
@@ -0,0 +1,401 @@
+/*######################################################################
+  #                                                                    #
+  # Round-robin history, see history.h.                                #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "history.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/*###### History file ###################################################*/
+
+/* The file holds a header, the raw tier as is, and two slots per older
+ * tier with the tier in delta coded form. Raw rows are written in place,
+ * and the header's 'seq' is odd meanwhile, so after a crash in between,
+ * the row being written is known. An older tier is coded into its unused
+ * slot, which only then is made current by a single store to 'slot', so
+ * a crash leaves either the previous or the new coded tier. */
+
+#define HIST_MAGIC	"WSMPHIS1"
+#define HIST_VERSION	4
+#define RAW_OFF		4096	/* header page, then the raw tier */
+#define BOOT_ID		"/proc/sys/kernel/random/boot_id"
+
+typedef struct hist_file_tier {
+	uint64_t step;
+	uint64_t end[2];     /* per slot; CLOCK_MONOTONIC, only valid in this
+	                        boot */
+	uint32_t idx;        /* of the raw tier, the others code it */
+	uint32_t slot;       /* current slot of an older tier, 0 for raw */
+	uint32_t len[2];     /* bytes used in each slot */
+} hist_file_tier;
+
+typedef struct hist_file {
+	char magic[8];
+	uint32_t version, series, rows, tiers;
+	char boot_id[40];
+	uint32_t check;      /* of everything above */
+	atomic_uint seq;     /* odd while a raw row is written */
+	hist_file_tier tier[HIST_TIERS];
+} hist_file;
+
+/* largest coded size of a tier: the oldest row, then per series 8 bits
+ * for the first value and at most 10 for every other one */
+static size_t slot_size(unsigned int series)
+{
+	return (8 + HIST_CF * series * (8 + (HIST_ROWS - 1) * 10ULL) + 7) / 8;
+}
+
+static size_t slot_off(unsigned int series, unsigned int tier,
+    unsigned int slot)
+{
+	return RAW_OFF + HIST_CF * series * HIST_ROWS +
+	    ((tier - 1) * 2 + slot) * slot_size(series);
+}
+
+static uint32_t header_check(const hist_file *f)
+{
+	const unsigned char *p = (const unsigned char *)f;
+	uint32_t h = 2166136261U; /* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < offsetof(hist_file, check); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static void read_boot_id(char *id)
+{
+	int fd = open(BOOT_ID, O_RDONLY | O_CLOEXEC);
+
+	memset(id, 0, 40);
+	if (fd != -1) {
+		if (read(fd, id, 39) < 0)
+			id[0] = 0;
+		close(fd);
+	}
+}
+
+/* Bit writer/reader for the coded tiers */
+typedef struct bits {
+	unsigned char *p;
+	size_t pos;          /* in bits */
+} bits;
+
+static void put_bits(bits *b, unsigned int v, unsigned int n)
+{
+	while (n--) {
+		if (v >> n & 1)
+			b->p[b->pos >> 3] |= 0x80 >> (b->pos & 7);
+		else
+			b->p[b->pos >> 3] &= ~(0x80 >> (b->pos & 7));
+		b->pos++;
+	}
+}
+
+static unsigned int get_bits(bits *b, unsigned int n)
+{
+	unsigned int v = 0;
+
+	while (n--) {
+		v = v << 1 | (b->p[b->pos >> 3] >> (7 - (b->pos & 7)) & 1);
+		b->pos++;
+	}
+	return v;
+}
+
+/* Codes the oldest row of 't', then every series oldest row first: the
+ * first value as is, then '0' for an unchanged value, '10' and a 3 bit signed delta for
+ * small steps, or '11' and the new value. Averaged load and memory
+ * move slowly, so most values take one or five bits. */
+static size_t tier_encode(const hist_tier *t, unsigned int series,
+    unsigned char *out)
+{
+	bits b = { out, 0 };
+	unsigned int f, s, r;
+	const unsigned char *v;
+	int d;
+
+	put_bits(&b, t->idx, 8);
+	for (f = 0; f < HIST_CF; f++) {
+		for (s = 0; s < series; s++) {
+			v = t->row[f] + s * HIST_ROWS;
+			put_bits(&b, v[t->idx], 8);
+			for (r = 1; r < HIST_ROWS; r++) {
+				d = v[(t->idx + r) % HIST_ROWS] -
+				    v[(t->idx + r - 1) % HIST_ROWS];
+				if (!d) {
+					put_bits(&b, 0, 1);
+				} else if (d >= -4 && d <= 3) {
+					put_bits(&b, 2, 2);
+					put_bits(&b, d & 7, 3);
+				} else {
+					put_bits(&b, 3, 2);
+					put_bits(&b, v[(t->idx + r) % HIST_ROWS], 8);
+				}
+			}
+		}
+	}
+	return (b.pos + 7) / 8;
+}
+
+static void tier_decode(hist_tier *t, unsigned int series,
+    unsigned char *in)
+{
+	bits b = { in, 0 };
+	unsigned int f, s, r, prev;
+	unsigned char *v;
+	int d;
+
+	if ((t->idx = get_bits(&b, 8)) >= HIST_ROWS)
+		t->idx = 0;
+	for (f = 0; f < HIST_CF; f++) {
+		for (s = 0; s < series; s++) {
+			v = t->row[f] + s * HIST_ROWS;
+			prev = v[t->idx] = get_bits(&b, 8);
+			for (r = 1; r < HIST_ROWS; r++) {
+				if (!get_bits(&b, 1)) {
+					/* unchanged */
+				} else if (!get_bits(&b, 1)) {
+					d = get_bits(&b, 3);
+					prev += d > 3 ? d - 8 : d;
+				} else {
+					prev = get_bits(&b, 8);
+				}
+				v[(t->idx + r) % HIST_ROWS] = prev;
+			}
+		}
+	}
+}
+
+/* Maps the history file 'path' for 'series' series and points the raw
+ * tier into it. An existing file of the same layout is taken over,
+ * anything else is started afresh. Returns -1 if there is no usable
+ * file, e.g. when another instance holds it. */
+static int history_map(history *h, const char *path)
+{
+	hist_file *f, want;
+	size_t len = slot_off(h->series, HIST_TIERS, 0);
+	unsigned int i, fn, s;
+	int fd, valid;
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		return -1;
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || ftruncate(fd, len) < 0) {
+		close(fd);
+		return -1;
+	}
+	f = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (f == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	memset(&want, 0, sizeof(want));
+	memcpy(want.magic, HIST_MAGIC, 8);
+	want.version = HIST_VERSION;
+	want.series = h->series;
+	want.rows = HIST_ROWS;
+	want.tiers = HIST_TIERS;
+	read_boot_id(want.boot_id);
+	valid = !memcmp(f, &want, offsetof(hist_file, boot_id)) &&
+	    f->check == header_check(f);
+	for (i = 0; valid && i < HIST_TIERS; i++) {
+		valid = f->tier[i].step == h->tier[i].step &&
+		    f->tier[i].idx < HIST_ROWS && f->tier[i].slot < 2 &&
+		    f->tier[i].len[f->tier[i].slot] <= slot_size(h->series);
+	}
+
+	h->fd = fd;
+	h->file = f;
+	h->file_len = len;
+	for (fn = 0; fn < HIST_CF; fn++) {
+		free(h->tier[HIST_RAW].row[fn]);
+		h->tier[HIST_RAW].row[fn] = (unsigned char *)f + RAW_OFF +
+		    fn * h->series * HIST_ROWS;
+	}
+
+	if (!valid) {
+		memset(f, 0, len);
+		memcpy(f, &want, sizeof(want));
+		f->check = header_check(f);
+		for (i = 0; i < HIST_TIERS; i++)
+			f->tier[i].step = h->tier[i].step;
+		return 0;
+	}
+
+	for (i = 0; i < HIST_TIERS; i++) {
+		h->tier[i].idx = f->tier[i].idx;
+		/* the monotonic clock restarted with the machine */
+		if (!memcmp(f->boot_id, want.boot_id, sizeof(want.boot_id)))
+			h->tier[i].end = f->tier[i].end[f->tier[i].slot];
+		if (i != HIST_RAW && f->tier[i].len[f->tier[i].slot]) {
+			tier_decode(&h->tier[i], h->series, (unsigned char *)f +
+			    slot_off(h->series, i, f->tier[i].slot));
+		}
+	}
+	if (atomic_load(&f->seq) & 1) {
+		/* died while writing a raw row: drop it */
+		for (fn = 0; fn < HIST_CF; fn++) {
+			for (s = 0; s < h->series; s++) {
+				h->tier[HIST_RAW].row[fn]
+				    [s * HIST_ROWS + h->tier[HIST_RAW].idx] = 0;
+			}
+		}
+		atomic_fetch_add(&f->seq, 1);
+	}
+	memcpy(f->boot_id, want.boot_id, sizeof(want.boot_id));
+	f->check = header_check(f);
+	return 0;
+}
+
+/*###### Consolidation ##################################################*/
+
+void history_init(history *h, unsigned int cpus, unsigned long long raw_ns,
+    const char *path)
+{
+	static const unsigned long long steps[HIST_TIERS] = {
+		0, 10 * NSEC_PER_SEC, 60 * NSEC_PER_SEC, 600 * NSEC_PER_SEC
+	};
+	hist_tier *t;
+	unsigned int i, f;
+
+	h->series = HIST_CPU0 + cpus;
+	h->file = NULL;
+	h->fd = -1;
+	for (i = 0; i < HIST_TIERS; i++) {
+		t = &h->tier[i];
+		t->step = i ? steps[i] : raw_ns;
+		t->end = 0;
+		t->idx = 0;
+		t->count = 0;
+		for (f = 0; f < HIST_CF; f++)
+			t->row[f] = calloc(h->series * HIST_ROWS, 1);
+		t->sum = calloc(h->series, sizeof(*t->sum));
+		t->min = calloc(h->series, 1);
+		t->max = calloc(h->series, 1);
+		if (!t->row[HIST_MIN] || !t->row[HIST_MEAN] ||
+		    !t->row[HIST_MAX] || !t->sum || !t->min || !t->max) {
+			fprintf(stderr, "Failed to allocate history for %u "
+			    "CPUs\n", cpus);
+			exit(1);
+		}
+	}
+	if (path && history_map(h, path) < 0)
+		fprintf(stderr, "History file %s not used\n", path);
+}
+
+/* completes the current row of tier 'i' */
+static void tier_commit(history *h, unsigned int i)
+{
+	hist_tier *t = &h->tier[i];
+	hist_file *f = h->file;
+	unsigned int s, at, slot;
+
+	if (f && i == HIST_RAW)
+		atomic_fetch_add_explicit(&f->seq, 1, memory_order_release);
+	for (s = 0, at = t->idx; s < h->series; s++, at += HIST_ROWS) {
+		/* rows without samples, e.g. while not running, stay empty */
+		t->row[HIST_MIN][at] = t->count ? t->min[s] : 0;
+		t->row[HIST_MEAN][at] = t->count ? t->sum[s] / t->count : 0;
+		t->row[HIST_MAX][at] = t->count ? t->max[s] : 0;
+	}
+	t->idx = (t->idx + 1) % HIST_ROWS;
+	t->count = 0;
+	t->end += t->step;
+	if (!f)
+		return;
+
+	if (i == HIST_RAW) {
+		f->tier[i].idx = t->idx;
+		f->tier[i].end[0] = t->end;
+		atomic_fetch_add_explicit(&f->seq, 1, memory_order_release);
+		return;
+	}
+	slot = !f->tier[i].slot;
+	f->tier[i].len[slot] = tier_encode(t, h->series,
+	    (unsigned char *)f + slot_off(h->series, i, slot));
+	f->tier[i].end[slot] = t->end;
+	/* the other slot is complete before it becomes current */
+	atomic_thread_fence(memory_order_release);
+	f->tier[i].slot = slot;
+}
+
+unsigned int history_add(history *h, unsigned long long ts,
+    const unsigned char *val, unsigned int shown)
+{
+	unsigned int i, s, added = 0;
+	hist_tier *t;
+
+	for (i = 0; i < HIST_TIERS; i++) {
+		t = &h->tier[i];
+		if (!t->end)
+			t->end = ts + t->step;
+		/* after a long stall only the last HIST_ROWS rows matter */
+		if (ts > t->end + HIST_ROWS * t->step)
+			t->end += ((ts - t->end) / t->step - HIST_ROWS) * t->step;
+		while (ts >= t->end) {
+			tier_commit(h, i);
+			if (i == shown)
+				added++;
+		}
+
+		if (!t->count) {
+			for (s = 0; s < h->series; s++) {
+				t->sum[s] = t->min[s] = t->max[s] = val[s];
+			}
+		} else {
+			for (s = 0; s < h->series; s++) {
+				t->sum[s] += val[s];
+				if (val[s] < t->min[s])
+					t->min[s] = val[s];
+				if (val[s] > t->max[s])
+					t->max[s] = val[s];
+			}
+		}
+		t->count++;
+	}
+	return added;
+}
+
+const unsigned char *history_series(const history *h, unsigned int tier,
+    unsigned int cf, unsigned int series)
+{
+	return h->tier[tier].row[cf] + series * HIST_ROWS;
+}
+
+void history_free(history *h)
+{
+	unsigned int i, f;
+
+	for (i = 0; i < HIST_TIERS; i++) {
+		for (f = 0; f < HIST_CF; f++) {
+			if (!h->file || i != HIST_RAW)
+				free(h->tier[i].row[f]);
+		}
+		free(h->tier[i].sum);
+		free(h->tier[i].min);
+		free(h->tier[i].max);
+	}
+	if (h->file) {
+		munmap(h->file, h->file_len);
+		close(h->fd);
+		h->file = NULL;
+	}
+}
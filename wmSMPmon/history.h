@@ -0,0 +1,88 @@
+/*######################################################################
+  #                                                                    #
+  # Round-robin history of every series shown by wmSMPmon, kept at     #
+  # several resolutions with min/mean/max consolidation, in the        #
+  # spirit of RRDtool. Memory use is fixed after history_init(). The   #
+  # history can live in a file, so that it survives a restart.         #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifndef WMSMP_HISTORY_H
+#define WMSMP_HISTORY_H
+
+#include "standards.h"
+
+/* Rows kept per tier: one graph width */
+#define HIST_ROWS	WIDTH_T
+
+/* Tiers, each row consolidating all samples of its time step */
+#define HIST_TIERS	4
+#define HIST_RAW	0	/* one graph column, COLUMN_TIME */
+#define HIST_10S	1
+#define HIST_1MIN	2
+#define HIST_10MIN	3
+
+/* Consolidation functions */
+#define HIST_MIN	0
+#define HIST_MEAN	1
+#define HIST_MAX	2
+#define HIST_CF		3
+
+/* Series, values are scaled to HEIGHT */
+#define HIST_ALL	0	/* mean load of all CPUs */
+#define HIST_RAM	1	/* used memory without caches */
+#define HIST_CACHE	2	/* used memory including caches */
+#define HIST_SWAP	3	/* swap or VRAM */
+#define HIST_GPU	4
+#define HIST_VIEW	5	/* VIEW_LINES lines of the view, if any */
+#define HIST_RUNQ	8	/* runnable tasks, HEIGHT / 2 for one per CPU */
+#define HIST_CPU0	9	/* first CPU, the others follow */
+
+typedef struct hist_tier {
+	unsigned long long step;    /* ns covered by one row */
+	unsigned long long end;     /* end of the row being consolidated */
+	unsigned int idx;           /* oldest row, written next */
+	/* structure of arrays: per function, HIST_ROWS values per series,
+	   series after series */
+	unsigned char *row[HIST_CF];
+	/* the row being consolidated, one value per series */
+	unsigned long *sum;
+	unsigned char *min, *max;
+	unsigned int count;         /* samples in it */
+} hist_tier;
+
+typedef struct history {
+	unsigned int series;        /* HIST_CPU0 + number of CPUs */
+	hist_tier tier[HIST_TIERS];
+	struct hist_file *file;     /* mapped history file, or NULL */
+	size_t file_len;
+	int fd;
+} history;
+
+/* Allocates a history for 'cpus' CPUs with a raw step of 'raw_ns'. With
+   a 'path', the history is kept in that file and taken over from it if
+   a previous run of the same layout left one; the raw tier is mapped,
+   the older tiers are stored delta coded. Without a usable file, e.g.
+   when another instance holds it, the history is only kept in memory. */
+void history_init(history *h, unsigned int cpus, unsigned long long raw_ns,
+    const char *path);
+
+/* Adds a sample taken at 'ts' (CLOCK_MONOTONIC ns), one value per
+   series. Rows that ended before 'ts' are completed first; rows without
+   samples, e.g. while not running, are left empty. Returns the number
+   of rows completed in tier 'shown'. */
+unsigned int history_add(history *h, unsigned long long ts,
+    const unsigned char *val, unsigned int shown);
+
+/* HIST_ROWS values of 'series' in 'tier'; the oldest is at index
+   h->tier[tier].idx */
+const unsigned char *history_series(const history *h, unsigned int tier,
+    unsigned int cf, unsigned int series);
+
+void history_free(history *h);
+
+#endif /* WMSMP_HISTORY_H */
@@ -30,21 +30,103 @@
 /*###### Image Size Definitions #########################################*/
 #define	WIDTH_T 44 /* Width Graph */
 #define	HEIGHT  31 /* Max. height of CPU Load Bar+Graph */
+#define	BAR_WIDTH 8 /* Width of the CPU load bar area */
 
-// file descriptor for /proc/stats
-static FILE *fd_stat = NULL;
+/*###### Limits #########################################################*/
+#define	MAX_CPUS 1024 /* CPUs beyond this are not monitored */
+
+/* Sysinfo_Setup selects the data source and must be called before
+   NumCpus_DoInit. 'root' is put in front of every /proc and /sys path
+   (NULL: the running system), every file read is appended to the
+   capture 'record' and, instead of the system, the capture 'replay' is
+   read at 'speed' times the recorded pace (0: no waiting). Returns -1
+   if the sysinfo-XXX module doesn't support this. */
+int Sysinfo_Setup(const char *root, const char *record, const char *replay,
+    double speed);
+
+/* Sysinfo_Paced returns 1 while the data source sets the sampling pace
+   itself, i.e. a replay waiting out the recorded intervals, so that the
+   sampler must not wait for its own timer */
+int Sysinfo_Paced(void);
+
+/*###### Views ##########################################################*/
+/* Instead of the memory lines, the graph of style 1 and the swap bar
+   can show a view of something else */
+#define	VIEW_NONE	0
+#define	VIEW_PSI	1 /* pressure stall information */
+#define	VIEW_CGROUP	2 /* one cgroup v2, the argument is its path */
+#define	VIEW_DISK	3 /* one block device, the argument is its name */
+#define	VIEW_NET	4 /* one network interface, or all with "all" */
+#define	VIEW_LINES	3 /* graph lines of a view */
+
+/* One view sample, all values on a scale from 0-100 */
+typedef struct view_snapshot {
+	unsigned int line[VIEW_LINES]; /* graph lines: red, yellow, blue */
+	unsigned int bar;   /* swap bar */
+	unsigned int mark;  /* marker in the swap bar */
+	int alert;          /* show the bar label in red */
+} view_snapshot;
+
+/* View_Setup selects a view with an optional argument, e.g. a path or
+   a filter, and must be called before NumCpus_DoInit. Returns -1 if the
+   sysinfo-XXX module doesn't support the view. */
+int View_Setup(int view, const char *arg);
 
 /* NumCPUs_DoInit returns the number of CPUs present in the system and
    performs any initialization necessary for the sysinfo-XXX module */
 unsigned int NumCpus_DoInit(void);
 
+/* Sysinfo_Close releases everything NumCpus_DoInit set up, e.g. open
+   files. No other function may be called afterwards. */
+void Sysinfo_Close(void);
+
 /* Get_CPU_Load returns an array of CPU loads, one for each CPU, scaled
    to HEIGHT. The array is defined and allocated by the main program
    and passed to the function as '*load'. The number of CPUs present
    is given in 'Cpu_tot' */
 unsigned int *Get_CPU_Load(unsigned int *load, unsigned int Cpu_tot);
 
-/* return current memory/swap usage on a scale from 0-100 */
+/* Get_CPU_Busy returns the share of time each CPU was busy over the
+   interval of the last Get_CPU_Load, in 1/1000 and without the
+   rounding Get_CPU_Load applies for drawing. '*busy' is like '*load' */
+unsigned int *Get_CPU_Busy(unsigned int *busy, unsigned int Cpu_tot);
+
+/* Get_CPU_Time returns the recorded CLOCK_MONOTONIC time, in ns, of the
+   data the last Get_CPU_Load replayed, or 0 when the loads are those of
+   the running system and the caller takes the time itself */
+unsigned long long Get_CPU_Time(void);
+
+/* One memory/swap sample, all values on a scale from 0-100 */
+typedef struct mem_snapshot {
+	unsigned int mem;   /* used memory without caches */
+	unsigned int mem2;  /* used memory including caches */
+	unsigned int swap;  /* used swap, 999 if no swap present */
+} mem_snapshot;
+
+/* Get_Mem_Snapshot reads memory and swap usage once and fills '*snap';
+   call it once per sampling round */
+void Get_Mem_Snapshot(mem_snapshot *snap);
+
+/* Scheduler activity from /proc/stat and /proc/loadavg, rates are per
+   second since the previous snapshot */
+typedef struct sched_snapshot {
+	unsigned int ctxt;     /* context switches */
+	unsigned int intr;     /* interrupts */
+	unsigned int softirq;  /* softirqs */
+	unsigned int running;  /* runnable tasks, besides a live sampler */
+	unsigned int blocked;  /* tasks waiting for I/O */
+	unsigned int load1;    /* one minute load average, in 1/100 */
+} sched_snapshot;
+
+/* Get_Sched_Snapshot fills '*snap' from the last Get_CPU_Load; call it
+   with Get_Mem_Snapshot. Zeros where the system doesn't tell. */
+void Get_Sched_Snapshot(sched_snapshot *snap);
+
+/* Get_View_Snapshot reads the view selected by View_Setup once and
+   fills '*snap', zeros without a view; call it with Get_Mem_Snapshot */
+void Get_View_Snapshot(view_snapshot *snap);
+
+/* return memory/swap usage of the latest snapshot on a scale from 0-100 */
 unsigned int Get_Memory(void);
 unsigned int Get_Memory2(void);
 unsigned int Get_Swap(void);
@@ -16,8 +16,10 @@
   #                                                                    #
   ######################################################################*/
 
+#include <time.h>
 #include "sysinfo-linux.h" /* include self to verify prototypes */
 #include "standards.h"
+#include "capture.h"
 
 #define BAD_OPEN_MESSAGE					\
 "Error: /proc must be mounted\n"				\
@@ -25,44 +27,223 @@
 "      /proc   /proc   proc    defaults\n"			\
 "  In the meantime, mount /proc /proc -t proc\n"
 
+#define STAT_FILE    "/proc/stat"
 #define MEMINFO_FILE "/proc/meminfo"
-static int meminfo_fd = -1;
+#define ONLINE_FILE  "/sys/devices/system/cpu/online"
+#define LOADAVG_FILE "/proc/loadavg"
 
-static char buf[1024];
+/* the sampler behind NumCpus_DoInit() and the Get_* functions */
+static sampler smp;
+
+/* data source, see Sysinfo_Setup() */
+static const char *proc_root = "";
+static const char *record_file, *replay_file;
+static double replay_speed = 1;
+
+/* see View_Setup() */
+static int view_kind = VIEW_NONE;
+static const char *view_arg;
 
 /* assume no IO-wait stats (default kernel 2.4.x),
    overridden if linux 2.5.x or 2.6.x */
 static const char *States_fmts = STATES_line2x4;
 
 
-/* This macro opens filename only if necessary and seeks to 0 so
- * that successive calls to the functions are more efficient.
- * It also reads the current contents of the file into the global buf.
- */
-#define FILE_TO_BUF(filename, fd) do {				\
-	static int local_n;					\
-	if (fd == -1 && (fd = open(filename, O_RDONLY)) == -1) {\
-		fprintf(stderr, BAD_OPEN_MESSAGE);		\
-		fflush(NULL);					\
-		_exit(102);					\
-	}							\
-	lseek(fd, 0L, SEEK_SET);				\
-	if ((local_n = read(fd, buf, sizeof buf - 1)) < 0) {\
-		perror(filename);				\
-		fflush(NULL);					\
-		_exit(103);					\
-	}							\
-	buf[local_n] = '\0';					\
-} while(0)
+/*###### Sampler context ##############################################*/
+
+/* Opens path below the -proc-root for proc_file_read(). The buffer
+ * starts at BIGBUFSIZ and grows as needed, e.g. /proc/meminfo is well
+ * over 1 KB on current kernels and /proc/stat has long 'intr' lines on
+ * large machines. Nothing is opened when replaying a capture.
+ * Returns -1 if the file can't be opened. */
+int proc_file_open(proc_file *f, unsigned int id, const char *path)
+{
+	f->id = id;
+	f->size = BIGBUFSIZ;
+	f->len = 0;
+	f->fd = -1;
+	f->path = malloc(strlen(proc_root) + strlen(path) + 1);
+	if (!f->path || !(f->buf = calloc(1, f->size + STAT_PAD))) {
+		fprintf(stderr, "Failed to allocate buffer for %s\n", path);
+		exit(1);
+	}
+	strcat(strcpy(f->path, proc_root), path);
+	if (capture_replaying())
+		return 0;
+	f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+	return f->fd == -1 ? -1 : 0;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Reads the whole file with a single pread() at offset 0 in the common
+ * case, so no seek or stdio buffering is involved. The buffer only grows
+ * when the file did not fit. The contents are followed by STAT_PAD zero
+ * bytes. Returns the length read, or -1 on errors. */
+ssize_t proc_file_read(proc_file *f)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	if (capture_replaying())
+		return capture_replay(f);
+	while ((n = pread(f->fd, f->buf + len, f->size - len, len)) > 0) {
+		len += n;
+		if (len < f->size)
+			break;
+		f->size *= 2;
+		if (!(f->buf = realloc(f->buf, f->size + STAT_PAD))) {
+			fprintf(stderr, "Failed to allocate buffer for %s\n",
+			    f->path);
+			exit(1);
+		}
+	}
+	if (n < 0)
+		return -1;
+	memset(f->buf + len, 0, STAT_PAD);
+	f->len = len;
+	f->ts = now_ns();
+	if (capture_recording())
+		capture_record(f);
+	return len;
+}
+
+void proc_file_close(proc_file *f)
+{
+	if (f->fd != -1)
+		close(f->fd);
+	f->fd = -1;
+	free(f->buf);
+	f->buf = NULL;
+	free(f->path);
+	f->path = NULL;
+}
+
+/* Allocates every tick array of 'cpus' in one block. Returns -1 if
+ * out of memory. */
+int cpu_ticks_alloc(CPU_t *cpus, unsigned int Cpu_tot)
+{
+	/* note: we allocate one more entry than Cpu_tot so that the
+	   last slot can hold tics representing the /proc/stat cpu
+	   summary (the first line read) -- that slot supports our
+	   View_CPUSUM toggle */
+	size_t n = Cpu_tot + 1;
+	TIC_t *block = calloc(1, (CPU_FIELDS + 2) * n * sizeof(TIC_t) +
+	    2 * n * sizeof(unsigned int) + n);
+	unsigned int f;
+
+	if (!block)
+		return -1;
+	for (f = 0; f < CPU_FIELDS; f++)
+		cpus->tic[f] = block + f * n;
+	cpus->charge = block + CPU_FIELDS * n;
+	cpus->total = block + (CPU_FIELDS + 1) * n;
+	cpus->dcharge = (unsigned int *)(block + (CPU_FIELDS + 2) * n);
+	cpus->dtotal = cpus->dcharge + n;
+	/* until told otherwise, every CPU is online */
+	cpus->online = (unsigned char *)(cpus->dtotal + n);
+	memset(cpus->online, 1, Cpu_tot);
+	cpus->online_tot = Cpu_tot;
+	cpus->moved = 0;
+	return 0;
+}
+
+void cpu_ticks_free(CPU_t *cpus)
+{
+	free(cpus->tic[0]);
+	memset(cpus, 0, sizeof(*cpus));
+}
+
+/* Opens every file the sampler reads and allocates the per-CPU tick
+ * storage for Cpu_tot CPUs. Returns -1 if a file can't be opened. */
+int sampler_open(sampler *s, unsigned int Cpu_tot)
+{
+	int rc = 0;
+
+	s->Cpu_tot = Cpu_tot;
+	s->stat_failed = 0;
+	if (cpu_ticks_alloc(&s->cpus, Cpu_tot) < 0) {
+		fprintf(stderr, "Failed to allocate per-CPU tick storage\n");
+		exit(1);
+	}
+	rc |= proc_file_open(&s->stat, PROC_STAT, STAT_FILE);
+	rc |= proc_file_open(&s->meminfo, PROC_MEMINFO, MEMINFO_FILE);
+	/* optional: without it, /proc/stat tells which CPUs are online */
+	proc_file_open(&s->online, PROC_ONLINE, ONLINE_FILE);
+	proc_file_open(&s->loadavg, PROC_LOADAVG, LOADAVG_FILE);
+	return rc;
+}
+
+void sampler_close(sampler *s)
+{
+	proc_file_close(&s->stat);
+	proc_file_close(&s->meminfo);
+	proc_file_close(&s->online);
+	proc_file_close(&s->loadavg);
+	view_close(&s->view);
+	cpu_ticks_free(&s->cpus);
+}
+
+int Sysinfo_Setup(const char *root, const char *record, const char *replay,
+    double speed)
+{
+	if (root)
+		proc_root = root;
+	record_file = record;
+	replay_file = replay;
+	replay_speed = speed;
+	return 0;
+}
+
+int Sysinfo_Paced(void)
+{
+	return capture_replaying() && !capture_replay_ended();
+}
+
+int View_Setup(int view, const char *arg)
+{
+	view_kind = view;
+	view_arg = arg;
+	return 0;
+}
+
+/* Counts the per-CPU lines of the /proc/stat below -proc-root, which
+ * need not be the one of the running system */
+static long count_stat_cpus(void)
+{
+	proc_file f;
+	const char *p;
+	long n = 0, id;
+
+	if (proc_file_open(&f, PROC_STAT, STAT_FILE) < 0 ||
+	    proc_file_read(&f) < 0) {
+		proc_file_close(&f);
+		return -1;
+	}
+	/* CPUs are numbered by id, offline ones have no line */
+	for (p = f.buf; (p = strstr(p, "\ncpu")); p += 4) {
+		if (p[4] >= '0' && p[4] <= '9' &&
+		    (id = strtol(p + 4, NULL, 10)) >= n)
+			n = id + 1;
+	}
+	proc_file_close(&f);
+	return n;
+}
 
 #define LINUX_VERSION(x,y,z)   (0x10000*(x) + 0x100*(y) + z)
 
 
-/***********************************************/
-/* get number of CPUs - max. 255 are supported */
-/* also, perform some initialisation           */
-/* code taken from top and procps              */
-/***********************************************/
+/****************************************************/
+/* get number of CPUs - max. MAX_CPUS are supported */
+/* also, perform some initialisation                */
+/* code taken from top and procps                   */
+/****************************************************/
 unsigned int NumCpus_DoInit(void)
 {
 	long smp_num_cpus;
@@ -87,16 +268,41 @@ unsigned int NumCpus_DoInit(void)
 		States_fmts = STATES_line2x6;
 	}
 
-	smp_num_cpus = sysconf(_SC_NPROCESSORS_CONF); // or _SC_NPROCESSORS_ONLN
+	if (replay_file) {
+		unsigned int cpus;
+
+		if (capture_replay_open(replay_file, replay_speed, &cpus) < 0) {
+			fprintf(stderr, "Can't replay %s\n", replay_file);
+			exit(1);
+		}
+		smp_num_cpus = cpus;
+	} else if (*proc_root) {
+		smp_num_cpus = count_stat_cpus();
+	} else {
+		smp_num_cpus = sysconf(_SC_NPROCESSORS_CONF); // or _SC_NPROCESSORS_ONLN
+	}
 	if (smp_num_cpus < 1) {
 		smp_num_cpus = 1; /* SPARC glibc is buggy */
 	}
 
-	if (smp_num_cpus > 8) {
-		/* we don't support more than 255 CPUs (well, in fact no more
-		   than eight at the moment... */
-		smp_num_cpus = 8;
+	if (smp_num_cpus > MAX_CPUS) {
+		/* per-CPU state is sized at runtime, but keep it bounded */
+		smp_num_cpus = MAX_CPUS;
+	}
+
+	/* by opening our files once, we'll avoid the hit on minor page
+	   faults (closed by Sysinfo_Close) */
+	if (sampler_open(&smp, smp_num_cpus) < 0) {
+		fprintf(stderr, BAD_OPEN_MESSAGE);
+		fflush(NULL);
+		_exit(102);
+	}
+	if (record_file && capture_record_open(record_file, smp_num_cpus) < 0) {
+		fprintf(stderr, "Can't record to %s\n", record_file);
+		exit(1);
 	}
+	if (view_open(&smp.view, view_kind, view_arg, smp_num_cpus) < 0)
+		exit(1);
 
 	return (int)smp_num_cpus;
 }
@@ -114,14 +320,12 @@ unsigned int NumCpus_DoInit(void)
  */
 typedef struct mem_table_struct {
 	const char *name;     /* memory type name */
+	unsigned int len;     /* strlen(name) */
 	unsigned long *slot;  /* slot in return struct */
+	int offset;           /* line offset in the last layout, -1 if absent */
 } mem_table_struct;
 
-static int compare_mem_table_structs(const void *a, const void *b)
-{
-    return strcmp(((const mem_table_struct *) a)->name,
-	((const mem_table_struct *) b)->name);
-}
+#define MEM_ROW(name, slot)	{ name, sizeof(name) - 1, slot, -1 }
 
 /* example data, following junk, with comments added:
  *
@@ -189,73 +393,107 @@ unsigned long kb_inactive;
 unsigned long kb_mapped;
 unsigned long kb_pagetables;
 
-static void meminfo(void)
-{
-	char namebuf[16]; /* big enough to hold any row name */
-	mem_table_struct findme = { namebuf, NULL};
-	mem_table_struct *found;
-	char *head;
-	char *tail;
-	static const mem_table_struct mem_table[] = {
-		{"Active",       &kb_active},       // important
-		{"Buffers",      &kb_main_buffers}, // important
-		{"Cached",       &kb_main_cached},  // important
-		{"Committed_AS", &kb_committed_as},
-		{"Dirty",        &kb_dirty},        // kB version of vmstat nr_dirty
-		{"HighFree",     &kb_high_free},
-		{"HighTotal",    &kb_high_total},
-		{"Inact_clean",  &kb_inact_clean},
-		{"Inact_dirty",  &kb_inact_dirty},
-		{"Inact_laundry",&kb_inact_laundry},
-		{"Inact_target", &kb_inact_target},
-		{"Inactive",     &kb_inactive},     // important
-		{"LowFree",      &kb_low_free},
-		{"LowTotal",     &kb_low_total},
-		{"Mapped",       &kb_mapped},       // kB version of vmstat nr_mapped
-		{"MemFree",      &kb_main_free},    // important
-		{"MemShared",    &kb_main_shared},  // important
-		{"MemTotal",     &kb_main_total},   // important
-		{"PageTables",   &kb_pagetables},   // kB version of vmstat
-						    // nr_page_table_pages
-		{"ReverseMaps",  &nr_reversemaps},  // same as vmstat
-						    // nr_page_table_pages
-		{"Slab",         &kb_slab},         // kB version of vmstat nr_slab
-		{"SwapCached",   &kb_swap_cached},
-		{"SwapFree",     &kb_swap_free},    // important
-		{"SwapTotal",    &kb_swap_total},   // important
-		{"Writeback",    &kb_writeback},    // kB version of vmstat
-						    // nr_writeback
-	};
-	const int mem_table_count =
-	    sizeof(mem_table) / sizeof(mem_table_struct);
-
-	FILE_TO_BUF(MEMINFO_FILE,meminfo_fd);
-
-	kb_inactive = ~0UL;
-
-	head = buf;
-	for(;;) {
-		tail = strchr(head, ':');
-		if (!tail)
-			break;
-		*tail = '\0';
-		if (strlen(head) >= sizeof(namebuf)) {
-			head = tail + 1;
-			goto nextline;
+static mem_table_struct mem_table[] = {
+	MEM_ROW("Active",       &kb_active),       // important
+	MEM_ROW("Buffers",      &kb_main_buffers), // important
+	MEM_ROW("Cached",       &kb_main_cached),  // important
+	MEM_ROW("Committed_AS", &kb_committed_as),
+	MEM_ROW("Dirty",        &kb_dirty),        // kB version of vmstat nr_dirty
+	MEM_ROW("HighFree",     &kb_high_free),
+	MEM_ROW("HighTotal",    &kb_high_total),
+	MEM_ROW("Inact_clean",  &kb_inact_clean),
+	MEM_ROW("Inact_dirty",  &kb_inact_dirty),
+	MEM_ROW("Inact_laundry",&kb_inact_laundry),
+	MEM_ROW("Inact_target", &kb_inact_target),
+	MEM_ROW("Inactive",     &kb_inactive),     // important
+	MEM_ROW("LowFree",      &kb_low_free),
+	MEM_ROW("LowTotal",     &kb_low_total),
+	MEM_ROW("Mapped",       &kb_mapped),       // kB version of vmstat nr_mapped
+	MEM_ROW("MemFree",      &kb_main_free),    // important
+	MEM_ROW("MemShared",    &kb_main_shared),  // important
+	MEM_ROW("MemTotal",     &kb_main_total),   // important
+	MEM_ROW("PageTables",   &kb_pagetables),   // kB version of vmstat
+						   // nr_page_table_pages
+	MEM_ROW("ReverseMaps",  &nr_reversemaps),  // same as vmstat
+						   // nr_page_table_pages
+	MEM_ROW("Slab",         &kb_slab),         // kB version of vmstat nr_slab
+	MEM_ROW("SwapCached",   &kb_swap_cached),
+	MEM_ROW("SwapFree",     &kb_swap_free),    // important
+	MEM_ROW("SwapTotal",    &kb_swap_total),   // important
+	MEM_ROW("Writeback",    &kb_writeback),    // kB version of vmstat
+						   // nr_writeback
+};
+#define MEM_TABLE_COUNT (sizeof(mem_table) / sizeof(mem_table_struct))
+
+/* length of the file when the line offsets in mem_table were taken */
+static ssize_t mem_layout_len = -1;
+
+/* Records the line offset of every row of mem_table in buf. Only needed
+ * when the layout changed, i.e. on the first read, with another kernel
+ * (replay) or when a value grew by a digit. */
+static void meminfo_layout(const char *buf, ssize_t len)
+{
+	const char *head = buf, *tail;
+	unsigned int i;
+
+	for (i = 0; i < MEM_TABLE_COUNT; i++)
+		mem_table[i].offset = -1;
+
+	while ((tail = strchr(head, ':'))) {
+		for (i = 0; i < MEM_TABLE_COUNT; i++) {
+			if (mem_table[i].len == (unsigned int)(tail - head) &&
+			    !memcmp(mem_table[i].name, head, mem_table[i].len)) {
+				mem_table[i].offset = head - buf;
+				break;
+			}
 		}
-		strcpy(namebuf, head);
-		found = bsearch(&findme, mem_table, mem_table_count,
-		    sizeof(mem_table_struct), compare_mem_table_structs);
-		head = tail + 1;
-		if (!found)
-			goto nextline;
-		*(found->slot) = strtoul(head, &tail, 10);
-nextline:
-		tail = strchr(head, '\n');
-		if (!tail)
+		if (!(tail = strchr(tail, '\n')))
 			break;
 		head = tail + 1;
 	}
+	mem_layout_len = len;
+}
+
+/* checks that every known row is still at its recorded offset */
+static int meminfo_layout_ok(const char *buf, ssize_t len)
+{
+	unsigned int i;
+
+	if (len != mem_layout_len)
+		return 0;
+	for (i = 0; i < MEM_TABLE_COUNT; i++) {
+		const char *p = buf + mem_table[i].offset;
+
+		if (mem_table[i].offset >= 0 &&
+		    (memcmp(p, mem_table[i].name, mem_table[i].len) ||
+		    p[mem_table[i].len] != ':'))
+			return 0;
+	}
+	return 1;
+}
+
+static int meminfo(void)
+{
+	const char *buf;
+	ssize_t len;
+	unsigned int i;
+
+	if ((len = proc_file_read(&smp.meminfo)) < 0) {
+		perror(smp.meminfo.path);
+		return -1;
+	}
+	buf = smp.meminfo.buf;	/* the read may have moved it */
+
+	if (!meminfo_layout_ok(buf, len))
+		meminfo_layout(buf, len);
+
+	kb_inactive = ~0UL;
+
+	for (i = 0; i < MEM_TABLE_COUNT; i++) {
+		if (mem_table[i].offset >= 0)
+			*(mem_table[i].slot) = strtoul(buf +
+			    mem_table[i].offset + mem_table[i].len + 1, NULL, 10);
+	}
 	if (!kb_low_total) {  /* low==main except with large-memory support */
 		kb_low_total = kb_main_total;
 		kb_low_free  = kb_main_free;
@@ -265,127 +503,486 @@ nextline:
 	}
 	kb_swap_used = kb_swap_total - kb_swap_free;
 	kb_main_used = kb_main_total - kb_main_free;
+	return 0;
 }
 
 /*************************************************************************/
 /*
- * This guy's modeled on libproc's 'five_cpu_numbers' function except
- * we preserve all cpu data in our CPU_t array which is organized
- * as follows:
- *    cpus[0] thru cpus[n] == tics for each separate cpu
- *    cpus[Cpu_tot]        == tics from the 1st /proc/stat line */
-static CPU_t *cpus_refresh (CPU_t *cpus, unsigned int Cpu_tot)
-{
-	int i;
-
-	// enough for a /proc/stat CPU line (not the intr line)
-	char buf[SMLBUFSIZ];
-
-	/* by opening this file once, we'll avoid the hit on minor page faults
-	   (sorry Linux, but you'll have to close it for us) */
-	if (!fd_stat) {
-		if (!(fd_stat = fopen("/proc/stat", "r"))) {
-			fprintf(stderr, "Failed to open /proc/stat: %s\n",  strerror(errno));
-			return(NULL);
+ * Hand-rolled /proc/stat tokenizer. The whole file is read at once and
+ * every 'cpu' line is parsed in a single pass, without sscanf.
+ */
+
+/* reads an unsigned decimal, skipping leading blanks; returns the position
+ * after the last digit, or NULL if no number follows on this line */
+const char *parse_tic(const char *p, TIC_t *val)
+{
+	TIC_t v = 0;
+
+	while (*p == ' ')
+		p++;
+	if ((unsigned char)(*p - '0') > 9)
+		return NULL;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* SWAR: convert eight digits at a time while we have them. The
+	 * buffer is padded with STAT_PAD zero bytes, so loading eight bytes
+	 * is safe anywhere before the terminating '\0'. */
+	for (;;) {
+		unsigned long long chunk;
+
+		memcpy(&chunk, p, sizeof(chunk));
+		if ((chunk & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL ||
+		    ((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL)
+		    != 0x3030303030303030ULL)
+			break;
+		chunk -= 0x3030303030303030ULL;
+		chunk = (chunk * 10) + (chunk >> 8);
+		chunk = (((chunk & 0x000000FF000000FFULL) *
+		    (100 + (1000000ULL << 32))) +
+		    (((chunk >> 16) & 0x000000FF000000FFULL) *
+		    (1 + (10000ULL << 32)))) >> 32;
+		v = v * 100000000ULL + chunk;
+		p += 8;
+	}
+#endif
+	while ((unsigned char)(*p - '0') <= 9)
+		v = v * 10 + (*p++ - '0');
+	*val = v;
+	return p;
+}
+
+/* fills entry 'j' of u, n, s, i and, if present, w, x, y from one
+ * 'cpu' line */
+static const char *parse_cpu_line(const char *p, CPU_t *cpus, unsigned int j)
+{
+	unsigned int f;
+
+	for (f = 0; f < CPU_FIELDS; f++) {
+		const char *next = parse_tic(p, &cpus->tic[f][j]);
+
+		if (!next) {
+			/* older kernels: fewer columns */
+			for (; f < CPU_FIELDS; f++)
+				cpus->tic[f][j] = 0;
+			break;
 		}
-		/* note: we allocate one more CPU_t than Cpu_tot so that the
-		   last slot can hold tics representing the /proc/stat cpu
-		   summary (the first line read) -- that slot supports our
-		   View_CPUSUM toggle */
-		cpus = calloc((1 + Cpu_tot),sizeof(CPU_t));
-	}
-	rewind(fd_stat);
-	fflush(fd_stat);
-
-	// first value the last slot with the cpu summary line
-	if (!fgets(buf, sizeof(buf), fd_stat)) {
-		fprintf(stderr, "Failed to read /proc/stat\n");
-		fclose(fd_stat);
-		fd_stat = NULL;
-		return (NULL);
-	}
-
-	cpus[Cpu_tot].x = 0;  // FIXME: can't tell by kernel version number
-	cpus[Cpu_tot].y = 0;  // FIXME: can't tell by kernel version number
-	if (4 > sscanf(buf, CPU_FMTS_JUST1, &cpus[Cpu_tot].u, &cpus[Cpu_tot].n,
-	    &cpus[Cpu_tot].s, &cpus[Cpu_tot].i, &cpus[Cpu_tot].w,
-	    &cpus[Cpu_tot].x, &cpus[Cpu_tot].y)) {
-				fprintf(stderr, "Failed to parse /proc/stat\n");
-				return (NULL);
+		p = next;
 	}
+	return p;
+}
+
+/* Picks the scheduler counters out of the lines from 'p' on, which
+ * follow the 'cpu' lines in the same image. Only the first number of
+ * the long 'intr' and 'softirq' lines is needed. */
+static void stat_parse_sched(const char *p, stat_sched *sched)
+{
+	TIC_t v;
+
+	for (; p; p = strchr(p, '\n')) {
+		while (*p == '\n')
+			p++;
+		if (!strncmp(p, "ctxt ", 5) && parse_tic(p + 5, &v))
+			sched->ctxt = v;
+		else if (!strncmp(p, "intr ", 5) && parse_tic(p + 5, &v))
+			sched->intr = v;
+		else if (!strncmp(p, "softirq ", 8) && parse_tic(p + 8, &v))
+			sched->softirq = v;
+		else if (!strncmp(p, "procs_running ", 14) &&
+		    parse_tic(p + 14, &v))
+			sched->running = v;
+		else if (!strncmp(p, "procs_blocked ", 14) &&
+		    parse_tic(p + 14, &v))
+			sched->blocked = v;
+	}
+}
+
+/* reads the CPU number after 'cpu', or Cpu_tot if out of range */
+static const char *parse_cpu_id(const char *p, unsigned int *id,
+    unsigned int Cpu_tot)
+{
+	unsigned int v = 0;
+
+	for (; (unsigned char)(*p - '0') <= 9; p++)
+		if ((v = v * 10 + (*p - '0')) > Cpu_tot)
+			v = Cpu_tot;
+	*id = v;
+	return p;
+}
+
+/* Parses the 'cpu' lines of a NUL-terminated /proc/stat image into the
+ * tick arrays of cpus, which are organized as follows:
+ *    [0] thru [n]  == tics for each separate cpu, by CPU id
+ *    [Cpu_tot]     == tics from the 1st /proc/stat line
+ * Offline CPUs have no line and keep their tics. Lines of CPUs not
+ * marked online are counted in cpus->moved. Returns the number of
+ * per-CPU lines parsed, or -1 if the summary line is missing. */
+int stat_parse(const char *p, CPU_t *cpus, unsigned int Cpu_tot,
+    stat_sched *sched)
+{
+	unsigned int n = 0, id, f;
+
+	if (strncmp(p, "cpu ", 4))
+		return -1;
+	p = parse_cpu_line(p + 3, cpus, Cpu_tot);
+	cpus->moved = 0;
+
 	// and just in case we're 2.2.xx compiled without SMP support...
 	if (1 == Cpu_tot) {
-		/* do it "manually", otherwise we overwrite charge and total */
-		cpus[0].u = cpus[1].u;
-		cpus[0].n = cpus[1].n;
-		cpus[0].s = cpus[1].s;
-		cpus[0].i = cpus[1].i;
-		cpus[0].w = cpus[1].w;
-		cpus[0].x = cpus[1].x;
-		cpus[0].y = cpus[1].y;
+		for (f = 0; f < CPU_FIELDS; f++)
+			cpus->tic[f][0] = cpus->tic[f][1];
+		if (sched)
+			stat_parse_sched(p, sched);
+		return 1;
 	}
 
 	// now value each separate cpu's tics
-	for (i = 0; 1 < Cpu_tot && i < Cpu_tot; i++) {
-		if (!fgets(buf, sizeof(buf), fd_stat)) {
-			fprintf(stderr, "Failed to read per-CPU entry in /proc/stat\n");
+	while ((p = strchr(p, '\n'))) {
+		p++;
+		if (p[0] != 'c' || p[1] != 'p' || p[2] != 'u')
+			break;
+		p = parse_cpu_id(p + 3, &id, Cpu_tot);
+		if (id >= Cpu_tot)
+			continue; /* beyond what we monitor */
+		p = parse_cpu_line(p, cpus, id);
+		cpus->moved += !cpus->online[id];
+		n++;
+	}
+	if (sched && p)
+		stat_parse_sched(p, sched);
+	return n;
+}
+
+/* Marks the CPUs of a list like "0-3,5,8-11" in 'mask'. Returns -1 if
+ * no CPU is given. */
+static int parse_cpu_list(const char *p, unsigned char *mask,
+    unsigned int Cpu_tot)
+{
+	unsigned int lo, hi;
+	int n = 0;
+
+	memset(mask, 0, Cpu_tot);
+	while ((unsigned char)(*p - '0') <= 9) {
+		p = parse_cpu_id(p, &lo, Cpu_tot);
+		hi = lo;
+		if (*p == '-')
+			p = parse_cpu_id(p + 1, &hi, Cpu_tot);
+		for (; lo <= hi && lo < Cpu_tot; lo++, n++)
+			mask[lo] = 1;
+		if (*p++ != ',')
+			break;
+	}
+	return n ? 0 : -1;
+}
+
+/* marks the CPUs having a line in a /proc/stat image in 'mask' */
+static void stat_cpu_ids(const char *p, unsigned char *mask,
+    unsigned int Cpu_tot)
+{
+	unsigned int id;
+
+	memset(mask, 0, Cpu_tot);
+	while ((p = strchr(p, '\n')) && !strncmp(++p, "cpu", 3)) {
+		parse_cpu_id(p + 3, &id, Cpu_tot);
+		if (id < Cpu_tot)
+			mask[id] = 1;
+	}
+}
+
+/* Takes the CPUs online from ONLINE_FILE, or from the last /proc/stat
+ * image if it can't be read. Only called when the CPUs in /proc/stat
+ * changed. CPUs coming back online restart from their current tics, so
+ * that their first load doesn't span the time they were offline. */
+static void cpus_online_update(sampler *s)
+{
+	unsigned char now[MAX_CPUS];
+	CPU_t *cpus = &s->cpus;
+	unsigned int j;
+
+	if (proc_file_read(&s->online) < 0 ||
+	    parse_cpu_list(s->online.buf, now, s->Cpu_tot) < 0)
+		stat_cpu_ids(s->stat.buf, now, s->Cpu_tot);
+
+	cpus->online_tot = 0;
+	for (j = 0; j < s->Cpu_tot; j++) {
+		if (now[j] && !cpus->online[j]) {
+			cpus->charge[j] = cpus->tic[CPU_U][j] +
+			    cpus->tic[CPU_S][j] + cpus->tic[CPU_N][j];
+			cpus->total[j] = cpus->charge[j] + cpus->tic[CPU_I][j];
 		}
-		cpus[i].x = 0;  // FIXME: can't tell by kernel version number
-		cpus[i].y = 0;  // FIXME: can't tell by kernel version number
-		if (4 > sscanf(buf, CPU_FMTS_MULTI, &cpus[i].u,
-		    &cpus[i].n, &cpus[i].s, &cpus[i].i, &cpus[i].w,
-		    &cpus[i].x, &cpus[i].y)){
-					fprintf(stderr, "Failed to parse per-CPU stats /proc/stat\n");
+		cpus->online[j] = now[j];
+		cpus->online_tot += now[j];
+	}
+}
+
+/*
+ * This guy's modeled on libproc's 'five_cpu_numbers' function except
+ * we preserve all cpu data in our CPU_t array (see stat_parse) */
+static int cpus_refresh (sampler *s)
+{
+	int lines;
+
+	/* errors are reported once until a read succeeds again, and not
+	   at all after the end of a replay, which was reported already */
+	if (proc_file_read(&s->stat) < 0) {
+		if (!s->stat_failed && !capture_replay_ended())
+			fprintf(stderr, "Failed to read %s\n", s->stat.path);
+		s->stat_failed = 1;
+		return -1;
+	}
+
+	if ((lines = stat_parse(s->stat.buf, &s->cpus, s->Cpu_tot,
+	    &s->sched)) < 0) {
+		if (!s->stat_failed)
+			fprintf(stderr, "Failed to parse %s\n", s->stat.path);
+		s->stat_failed = 1;
+		return -1;
+	}
+	s->stat_failed = 0;
+	if (CPUS_CHANGED(&s->cpus, lines))
+		cpus_online_update(s);
+	return 0;
+}
+
+/* A load scaled to HEIGHT has LOAD_BITS bits. Loads are computed on
+ * 32 bit lanes, so tick deltas are shifted down to LOAD_DELTA_BITS bits,
+ * leaving room for HEIGHT * delta. */
+#define LOAD_BITS 5
+#define LOAD_DELTA_BITS (31 - LOAD_BITS)
+#if HEIGHT >= (1 << LOAD_BITS)
+#error "LOAD_BITS too small for HEIGHT"
+#endif
+
+/* Scales busy / delta to HEIGHT: the largest q with q * delta < busy
+ * is found bit by bit, plus one, which is what the former floating
+ * point formula HEIGHT * dcharge / (dtotal + 0.001) + 1 came to. */
+static inline unsigned int load_scale(unsigned int busy, unsigned int delta)
+{
+	unsigned int q = 0, sum = 0, next;
+	int b;
+
+	for (b = LOAD_BITS - 1; b >= 0; b--) {
+		next = sum + (delta << b);
+		if (next < busy) {
+			sum = next;
+			q |= 1U << b;
 		}
 	}
-	return cpus;
+	/* scale cpu to a maximum of HEIGHT */
+	return q < HEIGHT ? q + 1 : HEIGHT;
 }
 
-unsigned int *Get_CPU_Load(unsigned int *load, unsigned int Cpu_tot)
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
+#ifdef __AVX2__
+#define LOAD_LANES 8
+#else
+#define LOAD_LANES 4 /* two SSE2 or NEON registers of ticks */
+#endif
+typedef TIC_t tic_vec __attribute__((vector_size(LOAD_LANES * sizeof(TIC_t))));
+typedef unsigned int load_vec
+    __attribute__((vector_size(LOAD_LANES * sizeof(unsigned int))));
+
+/* cpu_load_update() for LOAD_LANES CPUs at a time, without branches.
+ * Returns the number of CPUs done. */
+static unsigned int load_update_vec(const TIC_t *u, const TIC_t *n,
+    const TIC_t *s, const TIC_t *i, TIC_t *prev_charge, TIC_t *prev_total,
+    unsigned int *dcharge, unsigned int *dtotal, unsigned int shift,
+    unsigned int *load, unsigned int Cpu_tot)
 {
-	static CPU_t  *smpcpu = NULL;
 	unsigned int j;
-	register unsigned long charge, total = 0;
 
-	smpcpu = cpus_refresh(smpcpu, Cpu_tot);
+	for (j = 0; j + LOAD_LANES <= Cpu_tot; j += LOAD_LANES) {
+		tic_vec vu, vn, vs, vi, charge, total, prev;
+		load_vec busy, delta, q = { 0 }, sum = { 0 }, next, take;
+		int b;
+
+		memcpy(&vu, u + j, sizeof(vu));
+		memcpy(&vn, n + j, sizeof(vn));
+		memcpy(&vs, s + j, sizeof(vs));
+		memcpy(&vi, i + j, sizeof(vi));
+		charge = vu + vs + vn;
+		total = charge + vi;
+
+		memcpy(&prev, prev_charge + j, sizeof(prev));
+		busy = __builtin_convertvector((charge - prev) >> shift,
+		    load_vec);
+		memcpy(&prev, prev_total + j, sizeof(prev));
+		delta = __builtin_convertvector((total - prev) >> shift,
+		    load_vec);
+		memcpy(prev_charge + j, &charge, sizeof(charge));
+		memcpy(prev_total + j, &total, sizeof(total));
+		memcpy(dcharge + j, &busy, sizeof(busy));
+		memcpy(dtotal + j, &delta, sizeof(delta));
+		busy *= HEIGHT;
+
+#pragma GCC unroll 8
+		for (b = LOAD_BITS - 1; b >= 0; b--) {
+			next = sum + (delta << b);
+			take = (load_vec)(next < busy);
+			sum = (next & take) | (sum & ~take);
+			q |= take & (1U << b);
+		}
+		take = (load_vec)(q < HEIGHT);
+		q = ((q + 1) & take) | (HEIGHT & ~take);
+		memcpy(load + j, &q, sizeof(q));
+	}
+	return j;
+}
+#endif
+
+/* Turns the ticks since the previous call into loads scaled to HEIGHT,
+ * with integer shifts, adds and compares only, several CPUs at a time
+ * where the compiler supports vector types. The summary line at
+ * [Cpu_tot] adds up all CPUs, so its deltas bound those of each CPU
+ * and give the shift that makes them fit into 32 bits. The shifted
+ * deltas stay in dcharge and dtotal for Get_CPU_Busy. */
+void cpu_load_update(CPU_t *cpus, unsigned int *load, unsigned int Cpu_tot)
+{
+	const TIC_t *u = cpus->tic[CPU_U], *n = cpus->tic[CPU_N],
+	    *s = cpus->tic[CPU_S], *i = cpus->tic[CPU_I];
+	TIC_t *prev_charge = cpus->charge, *prev_total = cpus->total;
+	unsigned int *dcharge = cpus->dcharge, *dtotal = cpus->dtotal;
+	TIC_t charge, total;
+	unsigned int j = Cpu_tot, shift = 0;
+
+	/* only this wide on the first call, since boot */
+	total = u[j] + s[j] + n[j] + i[j];
+	while ((total - prev_total[j]) >> shift >> LOAD_DELTA_BITS)
+		shift++;
+	prev_total[j] = total;
+
+#ifdef LOAD_LANES
+	j = load_update_vec(u, n, s, i, prev_charge, prev_total, dcharge,
+	    dtotal, shift, load, Cpu_tot);
+#else
+	j = 0;
+#endif
+	for (; j < Cpu_tot; j++) {
+		charge = u[j] + s[j] + n[j];
+		total = charge + i[j];
+		dcharge[j] = (charge - prev_charge[j]) >> shift;
+		dtotal[j] = (total - prev_total[j]) >> shift;
+		load[j] = load_scale(HEIGHT * dcharge[j], dtotal[j]);
+		prev_total[j] = total;
+		prev_charge[j] = charge;
+	}
+
+	/* offline CPUs show no load at all */
+	if (cpus->online_tot < Cpu_tot)
+		for (j = 0; j < Cpu_tot; j++)
+			if (!cpus->online[j])
+				load[j] = dcharge[j] = 0;
+}
 
-	for (j = 0; j < Cpu_tot; j ++) {
-		charge = smpcpu[j].u + smpcpu[j].s + smpcpu[j].n;
-		total = charge + smpcpu[j].i;
+/* latest loads, for samples taken while /proc/stat can't be read */
+static unsigned int load_last[MAX_CPUS];
 
-		/* scale cpu to a maximum of HEIGHT */
-		load[j] = ((HEIGHT * (charge - smpcpu[j].charge)) /
-		    (total - smpcpu[j].total + 0.001)) + 1 ;
-		smpcpu[j].total = total ;
-		smpcpu[j].charge = charge ;
+unsigned int *Get_CPU_Load(unsigned int *load, unsigned int Cpu_tot)
+{
+	if (cpus_refresh(&smp) < 0) {
+		/* 'load' may be a different buffer than last time */
+		memcpy(load, load_last, Cpu_tot * sizeof(*load));
+		return load;
 	}
 
+	cpu_load_update(&smp.cpus, load, Cpu_tot);
+	memcpy(load_last, load, Cpu_tot * sizeof(*load));
 	return load;
 }
 
-unsigned int Get_Memory(void)
+unsigned int *Get_CPU_Busy(unsigned int *busy, unsigned int Cpu_tot)
 {
-	meminfo();
+	const CPU_t *cpus = &smp.cpus;
+	unsigned int j;
 
-	return ((kb_main_used - kb_main_cached) / (kb_main_total / 100));
-	/* should be between 0 and 100 now */
+	for (j = 0; j < Cpu_tot; j++)
+		busy[j] = cpus->dtotal[j] ? (unsigned long long)cpus->dcharge[j]
+		    * 1000 / cpus->dtotal[j] : 0;
+	return busy;
 }
 
-unsigned int Get_Memory2(void)
+unsigned long long Get_CPU_Time(void)
+{
+	return capture_replaying() ? smp.stat.ts : 0;
+}
+
+/* latest snapshot, returned by the Get_Memory/Get_Swap accessors */
+static mem_snapshot mem_last;
+
+void Get_Mem_Snapshot(mem_snapshot *snap)
+{
+	if (meminfo() < 0) {
+		*snap = mem_last;
+		return;
+	}
+
+	/* should all be between 0 and 100 now */
+	snap->mem = (kb_main_used - kb_main_cached) / (kb_main_total / 100);
+	snap->mem2 = kb_main_used / (kb_main_total / 100);
+
+	/* swap usage as value between 0 and 100
+	 * OR 999 if no swap present */
+	//snap->swap = (kb_swap_total == 0 ? 999 : kb_swap_used / (kb_swap_total / 100));
+	snap->swap = (kb_swap_total == 0 ? 999 : kb_swap_used > 0 && kb_swap_used < (kb_swap_total / 100) ? 1 : kb_swap_used / (kb_swap_total / 100));
+
+	mem_last = *snap;
+}
+
+void Get_View_Snapshot(view_snapshot *snap)
+{
+	view_read(&smp.view, snap);
+}
+
+/* per second from a counter delta over dt ns */
+#define PER_SEC(d, dt) ((unsigned int)((d) * 1000000000ULL / (dt)))
+
+void Get_Sched_Snapshot(sched_snapshot *snap)
 {
-	meminfo();
+	const stat_sched *now = &smp.sched, *prev = &smp.sched_prev;
+	unsigned long long dt = smp.stat.ts - smp.sched_ts;
+	const char *p;
+	TIC_t v;
+
+	memset(snap, 0, sizeof(*snap));
+	if (smp.sched_ts && dt && now->ctxt >= prev->ctxt &&
+	    now->intr >= prev->intr && now->softirq >= prev->softirq) {
+		snap->ctxt = PER_SEC(now->ctxt - prev->ctxt, dt);
+		snap->intr = PER_SEC(now->intr - prev->intr, dt);
+		snap->softirq = PER_SEC(now->softirq - prev->softirq, dt);
+	}
+	/* on the running system, the sampler itself is running while it
+	   reads /proc/stat; not so in a copy or a capture */
+	snap->running = now->running;
+	if (!*proc_root && !replay_file && snap->running)
+		snap->running--;
+	snap->blocked = now->blocked;
+	smp.sched_prev = *now;
+	smp.sched_ts = smp.stat.ts;
+
+	/* "0.52 0.58 0.59 2/1234 5678" */
+	if (proc_file_read(&smp.loadavg) > 0 &&
+	    (p = parse_tic(smp.loadavg.buf, &v))) {
+		snap->load1 = v * 100;
+		if (*p == '.' && (p = parse_tic(p + 1, &v)))
+			snap->load1 += v;
+	}
+}
 
-	return (kb_main_used / (kb_main_total / 100));
-	/* should be between 0 and 100 now */
+unsigned int Get_Memory(void)
+{
+	return mem_last.mem;
 }
 
+unsigned int Get_Memory2(void)
+{
+	return mem_last.mem2;
+}
 
 unsigned int Get_Swap(void)
 {
-	/* returns swap usage as value between 0 and 100
-	 * OR 999 if no swap present */
-	meminfo();
+	return mem_last.swap;
+}
 
-	//return (kb_swap_total == 0 ? 999 : kb_swap_used / (kb_swap_total / 100));
-	return (kb_swap_total == 0 ? 999 : kb_swap_used > 0 && kb_swap_used < (kb_swap_total / 100) ? 1 : kb_swap_used / (kb_swap_total / 100));
+void Sysinfo_Close(void)
+{
+	sampler_close(&smp);
+	capture_close();
 }
@@ -2,14 +2,14 @@
 #define LINUX_SYSINFO_H
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/utsname.h>
+#include "standards.h"
 
 
-/* These are the possible fscanf formats used in /proc/stat
-   reads during history processing.
-   ( 5th number only for Linux 2.5.41 and above ) */
-#define CPU_FMTS_JUST1  "cpu %Lu %Lu %Lu %Lu %Lu %Lu %Lu"
-#define CPU_FMTS_MULTI  "cpu%*d %Lu %Lu %Lu %Lu %Lu %Lu %Lu"
+/* Zero bytes kept after the /proc/stat image so that the tokenizer
+   may read a few bytes ahead without bounds checks */
+#define STAT_PAD 8
 
 /* Summary Lines specially formatted string(s) --
    see 'show_special' for syntax details + other cautions. */
@@ -23,12 +23,128 @@
 /* These typedefs attempt to ensure consistent 'ticks' handling */
 typedef unsigned long long TIC_t;
 
+/* The columns of a 'cpu' line, as represented in /proc/stat */
+#define CPU_U		0	/* user */
+#define CPU_N		1	/* nice */
+#define CPU_S		2	/* system */
+#define CPU_I		3	/* idle */
+#define CPU_W		4	/* IO-wait */
+#define CPU_X		5	/* hardware interrupts */
+#define CPU_Y		6	/* software interrupts */
+#define CPU_FIELDS	7
+
 /* This structure stores a frame's cpu tics used in history
-   calculations.  It exists primarily for SMP support but serves
-   all environments. */
+   calculations, one array per column so that the load math runs
+   over contiguous memory. It exists primarily for SMP support but
+   serves all environments. */
 typedef struct CPU_t {
-	TIC_t u, n, s, i, w, x, y; // as represented in /proc/stat
-	TIC_t charge, total;
+	TIC_t *tic[CPU_FIELDS]; /* Cpu_tot + 1 entries each, see stat_parse */
+	TIC_t *charge, *total;  /* busy and total tics at the previous update */
+	unsigned int *dcharge, *dtotal; /* their last deltas, shifted */
+	unsigned char *online;  /* 1 for CPUs online, indexed by CPU id */
+	unsigned int online_tot;
+	unsigned int moved;     /* lines of CPUs not online in the last image */
 } CPU_t;
 
+/* allocate and free the tick arrays for Cpu_tot CPUs */
+int cpu_ticks_alloc(CPU_t *cpus, unsigned int Cpu_tot);
+void cpu_ticks_free(CPU_t *cpus);
+
+/* reads an unsigned decimal after blanks, NULL if there is none */
+const char *parse_tic(const char *p, TIC_t *val);
+
+/* The counters following the 'cpu' lines of /proc/stat */
+typedef struct stat_sched {
+	TIC_t ctxt;             /* context switches since boot */
+	TIC_t intr;             /* interrupts since boot */
+	TIC_t softirq;          /* softirqs since boot */
+	unsigned int running;   /* procs_running */
+	unsigned int blocked;   /* procs_blocked */
+} stat_sched;
+
+/* parse the 'cpu' lines of a /proc/stat image and, unless 'sched' is
+   NULL, the counters after them, see sysinfo-linux.c */
+int stat_parse(const char *buf, CPU_t *cpus, unsigned int Cpu_tot,
+    stat_sched *sched);
+
+/* true if the CPUs in the last stat_parse() image aren't those online */
+#define CPUS_CHANGED(cpus, lines) \
+	((cpus)->moved || (unsigned int)(lines) != (cpus)->online_tot)
+
+/* loads since the previous call from freshly parsed ticks */
+void cpu_load_update(CPU_t *cpus, unsigned int *load, unsigned int Cpu_tot);
+
+/* Files read by the sampler, the ids are also used in capture files */
+#define PROC_STAT	0
+#define PROC_MEMINFO	1
+#define PROC_ONLINE	2	/* read when CPUs go on- or offline */
+#define PROC_PSI_CPU	3	/* -psi, see views-linux.c */
+#define PROC_PSI_MEMORY	4
+#define PROC_PSI_IO	5
+#define PROC_CG_CPU_STAT 6	/* -cgroup */
+#define PROC_CG_CPU_MAX	7
+#define PROC_CG_MEM_CUR	8
+#define PROC_CG_MEM_MAX	9
+#define PROC_CG_MEM_EVENTS 10
+#define PROC_DISKSTATS	11	/* -disk */
+#define PROC_NET_DEV	12	/* -net */
+#define PROC_LOADAVG	13
+#define PROC_FILES	14
+
+/* A /proc or /sys file that stays open while sampling. It is re-read
+   with pread() at offset 0 into a preallocated buffer. */
+typedef struct proc_file {
+	char *path;      /* including the -proc-root prefix */
+	unsigned int id; /* PROC_xxx */
+	int fd;
+	char *buf;       /* contents of the last read, STAT_PAD zero padded */
+	size_t size;     /* allocated size of buf, without the padding */
+	ssize_t len;     /* length of the last read */
+	unsigned long long ts; /* CLOCK_MONOTONIC of the last read, in ns */
+} proc_file;
+
+/* most files and counters a view reads, see views-linux.c */
+#define VIEW_FILES	5
+#define VIEW_COUNTERS	6
+
+/* The files and state of the view selected with View_Setup() */
+typedef struct view {
+	int kind;                  /* VIEW_xxx */
+	const char *arg;
+	unsigned int cpus;         /* Cpu_tot of the sampler */
+	proc_file f[VIEW_FILES];
+	unsigned int files;        /* entries of f in use */
+	size_t hint;               /* offset of the line read last time */
+	unsigned long long top;    /* top of an autoscaling log scale */
+	unsigned long long ts;     /* time of the counters in prev, in ns */
+	TIC_t prev[VIEW_COUNTERS]; /* counters at the previous read */
+} view;
+
+/* Sampler context: owns every file descriptor and buffer used to
+   sample the system, from sampler_open() until sampler_close() */
+typedef struct sampler {
+	proc_file stat;
+	proc_file meminfo;
+	proc_file online;
+	proc_file loadavg;
+	view view;
+	CPU_t cpus;
+	stat_sched sched;      /* from the last /proc/stat image */
+	stat_sched sched_prev; /* at the previous Get_Sched_Snapshot() */
+	unsigned long long sched_ts; /* time of sched_prev, in ns */
+	unsigned int Cpu_tot;
+	int stat_failed;       /* the last read or parse failed */
+} sampler;
+
+int proc_file_open(proc_file *f, unsigned int id, const char *path);
+ssize_t proc_file_read(proc_file *f);
+void proc_file_close(proc_file *f);
+
+int view_open(view *v, int kind, const char *arg, unsigned int cpus);
+void view_read(view *v, view_snapshot *snap);
+void view_close(view *v);
+
+int sampler_open(sampler *s, unsigned int Cpu_tot);
+void sampler_close(sampler *s);
+
 #endif /* LINUX_SYSINFO_H */
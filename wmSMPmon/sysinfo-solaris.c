@@ -8,6 +8,7 @@
 #include "standards.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <stdint.h>
 #include <kstat.h>
@@ -35,9 +36,29 @@ static struct cpu_states_info cpu_states[CPU_STATES] = {
 
 static kstat_ctl_t *kcp = NULL;
 static kstat_t *ksp_old;
+static int ksp_count = 0;	/* entries in ksp_old */
+static unsigned int *busy_last;	/* per CPU, in 1/1000 */
 
 static uint64_t physmem = 0;
 
+int Sysinfo_Setup(const char *root, const char *record, const char *replay,
+    double speed)
+{
+	/* the kstat interface has no files to redirect or capture */
+	return (root || record || replay) ? -1 : 0;
+}
+
+int Sysinfo_Paced(void)
+{
+	return (0);
+}
+
+int View_Setup(int view, const char *arg)
+{
+	/* none of the views has a kstat counterpart yet */
+	return view == VIEW_NONE ? 0 : -1;
+}
+
 /* NumCPUs_DoInit returns the number of CPUs present in the system and
    performs any initialization necessary for the sysinfo-XXX module */
 unsigned int NumCpus_DoInit(void)
@@ -62,7 +83,8 @@ unsigned int NumCpus_DoInit(void)
 	}
 
 	ksp_old = malloc(smp_num_cpus * sizeof (kstat_t));
-	if (ksp_old == NULL) {
+	busy_last = calloc(smp_num_cpus, sizeof (unsigned int));
+	if (ksp_old == NULL || busy_last == NULL) {
 		kstat_close(kcp);
 		fprintf(stderr, "ERROR: Can't allocate cpu load history.\n");
 		exit(1);
@@ -72,6 +94,7 @@ unsigned int NumCpus_DoInit(void)
 		ksp_old[i].ks_data = NULL;
 		ksp_old[i].ks_data_size = 0;
 	}
+	ksp_count = smp_num_cpus;
 
 	return smp_num_cpus;
 }
@@ -181,7 +204,7 @@ unsigned int *Get_CPU_Load(unsigned int *load, unsigned int Cpu_tot)
 {
 	kstat_t *ksp_new;
 	double factor;
-	uint64_t cur_load;
+	uint64_t cur_load, ticks;
 	int i;
 
 	if (kcp == NULL || ksp_old == NULL)
@@ -198,8 +221,8 @@ unsigned int *Get_CPU_Load(unsigned int *load, unsigned int Cpu_tot)
 			continue;
 		}
 
-		cur_load = cpu_ticks_delta(&ksp_old[i], ksp_new);
-		factor = HEIGHT / (double)cur_load;
+		ticks = cpu_ticks_delta(&ksp_old[i], ksp_new);
+		factor = HEIGHT / (double)ticks;
 
 		cur_load = kstat_delta(&ksp_old[i], ksp_new,
 		    cpu_states[1].field_name, &cpu_states[1].index) +
@@ -207,6 +230,7 @@ unsigned int *Get_CPU_Load(unsigned int *load, unsigned int Cpu_tot)
 		    &cpu_states[2].index);
 		if (ksp_old[i].ks_data) {
 			load[i] = factor * cur_load;
+			busy_last[i] = ticks ? cur_load * 1000 / ticks : 0;
 		}
 		kstat_copy(ksp_new, &ksp_old[i]);
 	}
@@ -263,3 +287,47 @@ unsigned int Get_Swap(void)
 
 	return (100 * (ai.ani_max - ai.ani_free) / ai.ani_max);
 }
+
+unsigned int *Get_CPU_Busy(unsigned int *busy, unsigned int Cpu_tot)
+{
+	if (busy_last != NULL)
+		memcpy(busy, busy_last, Cpu_tot * sizeof (*busy));
+	return (busy);
+}
+
+unsigned long long Get_CPU_Time(void)
+{
+	return (0);
+}
+
+void Get_Mem_Snapshot(mem_snapshot *snap)
+{
+	/* no separate cache figure available here */
+	snap->mem = snap->mem2 = Get_Memory();
+	snap->swap = Get_Swap();
+}
+
+void Get_View_Snapshot(view_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+}
+
+void Get_Sched_Snapshot(sched_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+}
+
+void Sysinfo_Close(void)
+{
+	int i;
+
+	for (i = 0; ksp_old != NULL && i < ksp_count; i++)
+		free(ksp_old[i].ks_data);
+	free(ksp_old);
+	ksp_old = NULL;
+	free(busy_last);
+	busy_last = NULL;
+	if (kcp != NULL)
+		kstat_close(kcp);
+	kcp = NULL;
+}
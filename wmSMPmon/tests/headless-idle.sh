@@ -0,0 +1,13 @@
+#!/bin/sh
+# Headless output of CPUs without a single busy tick must be 0, not the
+# one step the graphs add for drawing.
+
+fixtures=${srcdir:-.}/fixtures/idle
+out=$(./wmsmpmon -headless -r 10000 -proc-root "$fixtures" | head -n 4) ||
+	exit 1
+echo "$out"
+
+echo "$out" | awk -F, '
+	NR == 1 { if ($5 != "cpu0" || NF != 9) exit 1; next }
+	{ for (i = 5; i <= NF; i++) if ($i != "0.0") exit 1; n++ }
+	END { exit n != 3 }'
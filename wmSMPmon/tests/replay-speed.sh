@@ -0,0 +1,22 @@
+#!/bin/sh
+# A replay at -replay-speed 0 is not held back by the sampling timer:
+# two seconds recorded at 20 Hz must replay in well under one, with
+# the recorded timestamps still two seconds apart.
+
+cap=replay-speed.cap
+out=replay-speed.csv
+
+rm -f $cap
+timeout -s INT 2 ./wmsmpmon -headless -r 50000 -record $cap >/dev/null
+test -s $cap || exit 1
+
+start=$(date +%s%N)
+./wmsmpmon -headless -r 50000 -replay $cap -replay-speed 0 >$out
+ms=$(( ($(date +%s%N) - start) / 1000000 ))
+n=$(wc -l <$out)
+span=$(awk -F, 'NR == 2 { first = $1 } NR > 1 { last = $1 }
+    END { printf "%d", (last - first) / 1000000 }' $out)
+rm -f $cap $out
+echo "$n lines in $ms ms, spanning $span ms"
+
+test "$n" -gt 30 && test "$ms" -lt 500 && test "$span" -gt 1500
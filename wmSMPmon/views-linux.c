@@ -0,0 +1,551 @@
+/*######################################################################
+  #                                                                    #
+  # Views shown instead of the memory lines and the swap bar, see      #
+  # View_Setup() in standards.h. The files of a view are proc_files of #
+  # the sampler, so they stay open, are read with a single pread() and #
+  # go into -record captures like /proc/stat.                          #
+  #                                                                    #
+  # This file is placed under the conditions of the GNU Library        #
+  # General Public License, version 2, or any later version.           #
+  # See file COPYING for information on distribution conditions.       #
+  #                                                                    #
+  ######################################################################*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sysinfo-linux.h"
+#include "standards.h"
+
+/*###### Helpers ####################################################*/
+
+/* Maps x from [lo, lo * 10^decades] onto 0-100 on a log scale, linear
+ * within each decade. Below lo it is 0. */
+static unsigned int log_scale(unsigned long long x, unsigned long long lo,
+    unsigned int decades)
+{
+	unsigned int v = 0;
+
+	if (x < lo)
+		return 0;
+	while (x >= lo * 10 && v < decades * 100) {
+		lo *= 10;
+		v += 100;
+	}
+	if (v < decades * 100)
+		v += (x - lo) * 100 / (9 * lo);
+	return v / decades;
+}
+
+/* Finds the line of 'name' in a table like /proc/diskstats, where the
+ * name is preceded by a blank or starts the line and followed by 'sep'. The offset of the
+ * line found is kept in *hint and tried first next time, so while the
+ * table doesn't change, nothing is searched. Returns the position after
+ * 'sep', or NULL if there is no such line. */
+static const char *find_line(const proc_file *f, const char *name,
+    char sep, size_t *hint)
+{
+	size_t len = strlen(name);
+	const char *p = f->buf + *hint;
+
+	if (*hint && *hint + len < (size_t)f->len &&
+	    (p[-1] == ' ' || p[-1] == '\n') &&
+	    !memcmp(p, name, len) && p[len] == sep)
+		return p + len + 1;
+	for (p = f->buf; (p = strstr(p, name)); p += len) {
+		if (p > f->buf && (p[-1] == ' ' || p[-1] == '\n') &&
+		    p[len] == sep) {
+			*hint = p - f->buf;
+			return p + len + 1;
+		}
+	}
+	*hint = 0;
+	return NULL;
+}
+
+/*###### Pressure stall information ###################################*/
+
+/* full avg10, in percent, from which the label turns red */
+#define PSI_ALERT 10
+
+static const char *const psi_files[] = {
+	"/proc/pressure/cpu",
+	"/proc/pressure/memory",
+	"/proc/pressure/io",
+};
+
+/* Finds the 'some' or 'full' line of a pressure file and returns its
+ * avg10 rounded to a whole percent and its total stall time in us.
+ * Returns -1 if there is no such line, e.g. 'full' for the CPU on
+ * kernels before 5.13. */
+static int psi_line(const char *buf, const char *kind,
+    unsigned int *avg10, TIC_t *total)
+{
+	const char *p = strstr(buf, kind);
+	char *end;
+
+	if (!p || !(p = strstr(p, "avg10=")))
+		return -1;
+	*avg10 = strtoul(p + 6, &end, 10);
+	if (*end == '.' && end[1] >= '5' && end[1] <= '9')
+		(*avg10)++;
+	if (!(p = strstr(end, "total=")))
+		return -1;
+	*total = strtoull(p + 6, NULL, 10);
+	return 0;
+}
+
+static int psi_open(view *v)
+{
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		if (proc_file_open(&v->f[i], PROC_PSI_CPU + i,
+		    psi_files[i]) < 0) {
+			fprintf(stderr, "Can't open %s, the kernel needs "
+			    "CONFIG_PSI\n", v->f[i].path);
+			v->files = i + 1;
+			return -1;
+		}
+		v->files = i + 1;
+	}
+	return 0;
+}
+
+/* The lines are the some avg10 of the CPU, memory and io. The bar is
+ * the share of time since the previous read that some task stalled on
+ * the busiest of them, which follows bursts more closely than avg10;
+ * the marker is the highest full avg10. */
+static void psi_read(view *v, view_snapshot *snap)
+{
+	unsigned long long ts = 0, dt;
+	unsigned int i, avg, stall, full = 0;
+	TIC_t total;
+
+	for (i = 0; i < v->files; i++) {
+		if (proc_file_read(&v->f[i]) < 0)
+			continue;
+		ts = v->f[i].ts;
+		if (psi_line(v->f[i].buf, "some", &avg, &total) == 0) {
+			snap->line[i] = avg > 100 ? 100 : avg;
+			dt = (ts - v->ts) / 1000;
+			if (v->ts && dt && total >= v->prev[i]) {
+				stall = (total - v->prev[i]) * 100 / dt;
+				if (stall > snap->bar)
+					snap->bar = stall;
+			}
+			v->prev[i] = total;
+		}
+		if (psi_line(v->f[i].buf, "full", &avg, &total) == 0 &&
+		    avg > full)
+			full = avg;
+	}
+	v->ts = ts;
+	if (snap->bar > 100)
+		snap->bar = 100;
+	snap->mark = full > 100 ? 100 : full;
+	snap->alert = full >= PSI_ALERT;
+}
+
+/*###### cgroup v2 ####################################################*/
+
+#define CGROUP_ROOT "/sys/fs/cgroup/"
+
+/* the files of a cgroup, in PROC_CG_xxx order */
+static const char *const cgroup_files[] = {
+	"cpu.stat",
+	"cpu.max",
+	"memory.current",
+	"memory.max",
+	"memory.events",
+};
+
+/* counters kept in view.prev */
+#define CG_USAGE	0	/* cpu.stat usage_usec */
+#define CG_THROTTLED	1	/* cpu.stat throttled_usec */
+#define CG_NR_THROTTLED	2	/* cpu.stat nr_throttled */
+#define CG_MEM_EVENTS	3	/* memory.events max + oom_kill */
+
+/* Value of the 'key value' line 'key' in a flat keyed file like
+ * cpu.stat, 0 if there is none */
+static TIC_t keyed_value(const char *buf, const char *key)
+{
+	size_t len = strlen(key);
+	const char *p = buf;
+
+	while ((p = strstr(p, key))) {
+		if ((p == buf || p[-1] == '\n') && p[len] == ' ')
+			return strtoull(p + len + 1, NULL, 10);
+		p += len;
+	}
+	return 0;
+}
+
+/* Reads a file holding a number or "max", returns 0 for "max" or if
+ * it can't be read, e.g. in the root cgroup */
+static TIC_t cgroup_limit(proc_file *f)
+{
+	if (proc_file_read(f) <= 0 || !strncmp(f->buf, "max", 3))
+		return 0;
+	return strtoull(f->buf, NULL, 10);
+}
+
+/* The path is taken below CGROUP_ROOT, which it may start with, and
+ * leading or trailing slashes are dropped; "/" is the root cgroup. Only
+ * cpu.stat is needed, the other files are missing in the root cgroup
+ * or without the memory controller. */
+static int cgroup_open(view *v)
+{
+	const char *dir = v->arg;
+	size_t root = strlen(CGROUP_ROOT) - 1, len;
+	char path[PATH_MAX];
+	unsigned int i;
+
+	if (!strncmp(dir, CGROUP_ROOT, root) &&
+	    (dir[root] == '/' || !dir[root]))
+		dir += root;
+	while (*dir == '/')
+		dir++;
+	for (len = strlen(dir); len && dir[len - 1] == '/'; len--)
+		;
+	for (i = 0; i < 5; i++) {
+		if (len)
+			snprintf(path, sizeof(path), CGROUP_ROOT "%.*s/%s",
+			    (int)len, dir, cgroup_files[i]);
+		else
+			snprintf(path, sizeof(path), CGROUP_ROOT "%s",
+			    cgroup_files[i]);
+		if (proc_file_open(&v->f[i], PROC_CG_CPU_STAT + i, path) < 0
+		    && i == 0) {
+			fprintf(stderr, "Can't open %s, is %s a cgroup v2?\n",
+			    v->f[i].path, v->arg);
+			v->files = 1;
+			return -1;
+		}
+		v->files = i + 1;
+	}
+	return 0;
+}
+
+/* The bar is the CPU usage against the cpu.max quota, or against all
+ * CPUs without one, the marker the memory usage against memory.max,
+ * or against the RAM without one. The lines are the share of time
+ * throttled (red), the memory (yellow) and the CPU (blue). The label
+ * is red while the cgroup is throttled or reclaims at memory.max. */
+static void cgroup_read(view *v, view_snapshot *snap)
+{
+	proc_file *f = v->f;
+	unsigned long long ts, dt, quota, period = 0, mem, mem_max;
+	TIC_t now[VIEW_COUNTERS] = { 0 };
+	unsigned int i;
+	char *end;
+
+	if (proc_file_read(&f[0]) < 0)
+		return;
+	ts = f[0].ts;
+	now[CG_USAGE] = keyed_value(f[0].buf, "usage_usec");
+	now[CG_THROTTLED] = keyed_value(f[0].buf, "throttled_usec");
+	now[CG_NR_THROTTLED] = keyed_value(f[0].buf, "nr_throttled");
+	now[CG_MEM_EVENTS] = 0;
+	if (proc_file_read(&f[4]) > 0)
+		now[CG_MEM_EVENTS] = keyed_value(f[4].buf, "max") +
+		    keyed_value(f[4].buf, "oom_kill");
+
+	/* cpu.max is "$MAX $PERIOD", $MAX may be "max" */
+	quota = cgroup_limit(&f[1]);
+	if (quota) {
+		strtoull(f[1].buf, &end, 10);
+		period = strtoull(end, NULL, 10);
+	}
+	if (!quota || !period) {
+		quota = v->cpus;
+		period = 1;
+	}
+
+	if (proc_file_read(&f[2]) > 0) {
+		mem = strtoull(f[2].buf, NULL, 10);
+		if (!(mem_max = cgroup_limit(&f[3])))
+			mem_max = (unsigned long long)sysconf(_SC_PHYS_PAGES) *
+			    sysconf(_SC_PAGESIZE);
+		if (mem_max)
+			snap->mark = mem >= mem_max ? 100 : mem * 100 / mem_max;
+		snap->line[1] = snap->mark;
+	}
+
+	dt = (ts - v->ts) / 1000;
+	if (v->ts && dt) {
+		for (i = 0; i < VIEW_COUNTERS; i++)
+			if (now[i] < v->prev[i])
+				v->prev[i] = now[i]; /* cgroup was recreated */
+		/* usage_usec counts CPU time: quota / period CPUs at most */
+		snap->bar = (now[CG_USAGE] - v->prev[CG_USAGE]) * period *
+		    100 / (dt * quota);
+		if (snap->bar > 100)
+			snap->bar = 100;
+		snap->line[2] = snap->bar;
+		snap->line[0] = (now[CG_THROTTLED] - v->prev[CG_THROTTLED]) *
+		    100 / dt;
+		if (snap->line[0] > 100)
+			snap->line[0] = 100;
+		snap->alert = now[CG_NR_THROTTLED] != v->prev[CG_NR_THROTTLED]
+		    || now[CG_MEM_EVENTS] != v->prev[CG_MEM_EVENTS];
+	}
+	memcpy(v->prev, now, sizeof(now));
+	v->ts = ts;
+}
+
+/*###### Block device ###############################################*/
+
+#define DISKSTATS "/proc/diskstats"
+#define DISK_SLOW_US 50000	/* mean latency that turns the label red */
+
+/* the columns of /proc/diskstats after the name */
+#define DS_READS	0	/* reads completed */
+#define DS_READ_SECT	2	/* sectors read, 512 bytes each */
+#define DS_WRITES	4
+#define DS_WRITE_SECT	6
+#define DS_IO_TICKS	9	/* ms spent doing I/O */
+#define DS_QUEUE_TIME	10	/* weighted ms spent doing I/O */
+#define DS_FIELDS	11
+
+/* counters kept in view.prev */
+#define DISK_READS	0
+#define DISK_READ_SECT	1
+#define DISK_WRITES	2
+#define DISK_WRITE_SECT	3
+#define DISK_IO_TICKS	4
+#define DISK_QUEUE_TIME	5
+
+static int disk_open(view *v)
+{
+	if (!strncmp(v->arg, "/dev/", 5))
+		v->arg += 5;
+	v->files = 1;
+	if (proc_file_open(&v->f[0], PROC_DISKSTATS, DISKSTATS) < 0) {
+		fprintf(stderr, "Can't open %s\n", v->f[0].path);
+		return -1;
+	}
+	if (proc_file_read(&v->f[0]) > 0 &&
+	    !find_line(&v->f[0], v->arg, ' ', &v->hint)) {
+		fprintf(stderr, "No device %s in %s\n", v->arg, v->f[0].path);
+		return -1;
+	}
+	return 0;
+}
+
+/* The bar is the %util of the device, i.e. the share of time it was
+ * busy, its marker the mean latency of the I/Os completed since the
+ * previous read, from 10 us to 1 s on a log scale. The lines are the
+ * IOPS (red, 1 to 10^6) and the bytes read (yellow) and written (blue)
+ * per second, from 1 KB/s to 10 GB/s, all on log scales. */
+static void disk_read(view *v, view_snapshot *snap)
+{
+	TIC_t ds[DS_FIELDS], now[VIEW_COUNTERS], d[VIEW_COUNTERS];
+	unsigned long long dt, ios;
+	const char *p;
+	unsigned int i;
+
+	if (proc_file_read(&v->f[0]) < 0 ||
+	    !(p = find_line(&v->f[0], v->arg, ' ', &v->hint)))
+		return;
+	for (i = 0; i < DS_FIELDS; i++)
+		if (!(p = parse_tic(p, &ds[i])))
+			return;
+	now[DISK_READS] = ds[DS_READS];
+	now[DISK_READ_SECT] = ds[DS_READ_SECT];
+	now[DISK_WRITES] = ds[DS_WRITES];
+	now[DISK_WRITE_SECT] = ds[DS_WRITE_SECT];
+	now[DISK_IO_TICKS] = ds[DS_IO_TICKS];
+	now[DISK_QUEUE_TIME] = ds[DS_QUEUE_TIME];
+
+	dt = (v->f[0].ts - v->ts) / 1000;
+	if (v->ts && dt) {
+		for (i = 0; i < VIEW_COUNTERS; i++)
+			d[i] = now[i] >= v->prev[i] ? now[i] - v->prev[i] : 0;
+		snap->bar = d[DISK_IO_TICKS] * 100000 / dt;
+		if (snap->bar > 100)
+			snap->bar = 100;
+		ios = d[DISK_READS] + d[DISK_WRITES];
+		if (ios) {
+			snap->mark = log_scale(d[DISK_QUEUE_TIME] * 1000 / ios,
+			    10, 5);
+			snap->alert = d[DISK_QUEUE_TIME] * 1000 / ios >=
+			    DISK_SLOW_US;
+		}
+		snap->line[0] = log_scale(ios * 1000000 / dt, 1, 6);
+		snap->line[1] = log_scale(d[DISK_READ_SECT] * 512000000 / dt,
+		    1000, 7);
+		snap->line[2] = log_scale(d[DISK_WRITE_SECT] * 512000000 / dt,
+		    1000, 7);
+	}
+	memcpy(v->prev, now, sizeof(now));
+	v->ts = v->f[0].ts;
+}
+
+/*###### Network ####################################################*/
+
+#define NET_DEV "/proc/net/dev"
+#define NET_ALL "all"		/* -net argument adding up all interfaces */
+#define NET_DECADES 5		/* decades shown below the scale's top */
+#define NET_RANGE 100000	/* 10^NET_DECADES */
+
+/* the columns of /proc/net/dev after the name */
+#define ND_RX_BYTES	0
+#define ND_RX_PACKETS	1
+#define ND_RX_ERRS	2
+#define ND_RX_DROP	3
+#define ND_TX_BYTES	8
+#define ND_TX_PACKETS	9
+#define ND_TX_ERRS	10
+#define ND_TX_DROP	11
+#define ND_FIELDS	12
+
+/* counters kept in view.prev */
+#define NET_RX_BYTES	0
+#define NET_RX_PACKETS	1
+#define NET_TX_BYTES	2
+#define NET_TX_PACKETS	3
+#define NET_ERRORS	4	/* errors and drops, both ways */
+
+static int net_open(view *v)
+{
+	v->files = 1;
+	v->top = 1000000;
+	if (proc_file_open(&v->f[0], PROC_NET_DEV, NET_DEV) < 0) {
+		fprintf(stderr, "Can't open %s\n", v->f[0].path);
+		return -1;
+	}
+	if (strcmp(v->arg, NET_ALL) && proc_file_read(&v->f[0]) > 0 &&
+	    !find_line(&v->f[0], v->arg, ':', &v->hint)) {
+		fprintf(stderr, "No interface %s in %s\n", v->arg,
+		    v->f[0].path);
+		return -1;
+	}
+	return 0;
+}
+
+/* adds the counters of the interface line at 'p' to 'now' */
+static int net_line(const char *p, TIC_t *now)
+{
+	TIC_t nd[ND_FIELDS];
+	unsigned int i;
+
+	for (i = 0; i < ND_FIELDS; i++)
+		if (!(p = parse_tic(p, &nd[i])))
+			return -1;
+	now[NET_RX_BYTES] += nd[ND_RX_BYTES];
+	now[NET_RX_PACKETS] += nd[ND_RX_PACKETS];
+	now[NET_TX_BYTES] += nd[ND_TX_BYTES];
+	now[NET_TX_PACKETS] += nd[ND_TX_PACKETS];
+	now[NET_ERRORS] += nd[ND_RX_ERRS] + nd[ND_RX_DROP] +
+	    nd[ND_TX_ERRS] + nd[ND_TX_DROP];
+	return 0;
+}
+
+/* The lines are the errors and drops per second (red, 1 to 10^6) and
+ * the bytes received (yellow) and sent (blue) per second, the bar is
+ * both added up, its marker the packets per second (1 to 10^7). Bytes
+ * are on a log scale of NET_DECADES below a top that grows in decades
+ * with the traffic seen. The label is red while packets are dropped or
+ * have errors. With NET_ALL, every interface but lo is added up. */
+static void net_read(view *v, view_snapshot *snap)
+{
+	TIC_t now[VIEW_COUNTERS] = { 0 }, d[VIEW_COUNTERS];
+	unsigned long long dt, rx, tx;
+	const char *p, *colon;
+	unsigned int i;
+
+	if (proc_file_read(&v->f[0]) < 0)
+		return;
+	if (strcmp(v->arg, NET_ALL)) {
+		if (!(p = find_line(&v->f[0], v->arg, ':', &v->hint)) ||
+		    net_line(p, now) < 0)
+			return;
+	} else {
+		/* two header lines, then one line per interface */
+		for (p = v->f[0].buf, i = 0; i < 2 && p; i++)
+			if ((p = strchr(p, '\n')))
+				p++;
+		for (; p && (colon = strchr(p, ':')); p = strchr(colon, '\n')) {
+			while (*p == ' ' || *p == '\n')
+				p++;
+			if (colon - p != 2 || memcmp(p, "lo", 2))
+				net_line(colon + 1, now);
+		}
+	}
+
+	dt = (v->f[0].ts - v->ts) / 1000;
+	if (v->ts && dt) {
+		for (i = 0; i < VIEW_COUNTERS; i++)
+			d[i] = now[i] >= v->prev[i] ? now[i] - v->prev[i] : 0;
+		rx = d[NET_RX_BYTES] * 1000000 / dt;
+		tx = d[NET_TX_BYTES] * 1000000 / dt;
+		while (rx + tx > v->top)
+			v->top *= 10;
+		snap->line[0] = log_scale(d[NET_ERRORS] * 1000000 / dt, 1, 6);
+		snap->line[1] = log_scale(rx, v->top / NET_RANGE, NET_DECADES);
+		snap->line[2] = log_scale(tx, v->top / NET_RANGE, NET_DECADES);
+		snap->bar = log_scale(rx + tx, v->top / NET_RANGE, NET_DECADES);
+		snap->mark = log_scale((d[NET_RX_PACKETS] +
+		    d[NET_TX_PACKETS]) * 1000000 / dt, 1, 7);
+		snap->alert = d[NET_ERRORS] != 0;
+	}
+	memcpy(v->prev, now, sizeof(now));
+	v->ts = v->f[0].ts;
+}
+
+/*###### Views ########################################################*/
+
+/* Opens the files of view 'kind'. Nothing is opened for VIEW_NONE.
+ * Returns -1 after telling why if the view can't be shown. */
+int view_open(view *v, int kind, const char *arg, unsigned int cpus)
+{
+	memset(v, 0, sizeof(*v));
+	v->kind = kind;
+	v->arg = arg;
+	v->cpus = cpus;
+	switch (kind) {
+	case VIEW_PSI:
+		return psi_open(v);
+	case VIEW_CGROUP:
+		return cgroup_open(v);
+	case VIEW_DISK:
+		return disk_open(v);
+	case VIEW_NET:
+		return net_open(v);
+	}
+	return 0;
+}
+
+/* Fills 'snap' with a new sample of the view, zeros for VIEW_NONE */
+void view_read(view *v, view_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+	switch (v->kind) {
+	case VIEW_PSI:
+		psi_read(v, snap);
+		break;
+	case VIEW_CGROUP:
+		cgroup_read(v, snap);
+		break;
+	case VIEW_DISK:
+		disk_read(v, snap);
+		break;
+	case VIEW_NET:
+		net_read(v, snap);
+		break;
+	}
+}
+
+void view_close(view *v)
+{
+	unsigned int i;
+
+	for (i = 0; i < v->files; i++)
+		proc_file_close(&v->f[i]);
+	v->files = 0;
+}
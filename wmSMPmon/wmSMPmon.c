@@ -21,10 +21,16 @@ CURRENT MAINTAINER: Thomas Ribbrock <emgaron@gmx.net>
 #include	<X11/xpm.h>
 #include	<X11/extensions/shape.h>
 #include	<signal.h>
+#include	<poll.h>
+#include	<limits.h>
 #include	"wmgeneral.h"
 #include	"wmSMPmon_master.xpm"
 #include	"wmSMPmon_mask.xbm"
 #include	"standards.h"
+#include	"collector.h"
+#include	"headless.h"
+#include	"history.h"
+#include	"graph.h"
 #ifdef HAVE_NVIDIA
 #include	"nvml.h"
 #endif
@@ -34,8 +40,27 @@ CURRENT MAINTAINER: Thomas Ribbrock <emgaron@gmx.net>
 #endif
 
 /*###### Dividers for redraw-loops ######################################*/
-#define		DIV1		6
-#define		DIV2		10
+#define		DIV1		6	/* memory is sampled every DIV1 + 1 frames */
+
+/*###### Sampling #######################################################*/
+/* default us between two samples; short bursts show up as peaks in the
+ * graph, while the load bars show the mean of each frame */
+#define		SAMPLE_DELAY	20000
+
+/*###### Graph timebase #################################################*/
+#define		COLUMN_TIME	2750ULL	/* ms of history per graph column */
+#define		COLUMN_NS	(COLUMN_TIME * 1000000ULL)
+/* while hidden: waking up twice per column keeps the history going */
+#define		HIDDEN_DELAY	(COLUMN_TIME * 1000 / 2)
+
+/*###### History file, in $XDG_RUNTIME_DIR ##############################*/
+#define		HIST_FILE	"wmsmpmon.hist"
+
+/*###### View labels, see wmSMPmon_master.xpm ##########################*/
+/* 18x8 label of view k in the swap bar slot, red below when alerting */
+#define		VIEW_LABEL_X(k)	(1 + 21 * ((k) - 1))
+#define		VIEW_LABEL_Y	79
+#define		VIEW_ALERT_Y	87
 
 /*###### Messages #######################################################*/
 #define		MSG_NO_SWAP	"No swap mode : Swap is not monitored.\n"
@@ -71,16 +96,11 @@ unsigned int Get_VRAM() {
 #endif
 
 
+/* set by sig_handler, the main loop then shuts down cleanly */
+static volatile sig_atomic_t terminate = 0;
+
 static void sig_handler(int s){
-	printf("Caught signal %d, terminating gracefully\n",s);
-#ifdef HAVE_NVIDIA
-	nvmlShutdown();
-#endif
-	if (fd_stat) {
-		fclose(fd_stat);
-		fd_stat = NULL;
-	}
-	exit(0); 
+	terminate = s;
 }
 
 /*###### MAIN PROGRAM ###################################################*/
@@ -88,41 +108,57 @@ int main(int argc, char **argv)
 {
 	XEvent		Event;
 
-	unsigned short offset = 0,
-			c1 = DIV1,
-			c2 = DIV2,
-			etat = 1,
-			lecture = 1,
+	unsigned short etat = 1,
+			new_sample = 0, /* samples arrived since the last frame */
 			no_swap = 0,
-			draw_mem = 0,
 			draw_graph = 1,
+			full_graph = 1, /* redraw all columns, not just the newest */
+			visible = 1, /* dockapp can be seen, else don't render */
 			NumCPUs,      /* number of CPUs */
 			i = 0,        /* counter */
 			mem = 0, /* current memory/swap scaled to 0-100 */
 			prec_mem = 0, /* memory from previous round */
 			mem2 = 0, /* current memory incl caches*/
 			prec_mem2 = 0, /* memory_cache from previous round */
-			prec_swap = 0, /* swap from previous round */
-			load_width = 3; /* width of load bar: 3 for SMP, 8 for UP */
-	unsigned int	t0[WIDTH_T], /* history for CPU 0 -> Graph */
-			t1[WIDTH_T], /* history for CPU 1 -> Graph */
-			tm[WIDTH_T], /* history for CPU 0+1 -> Graph */
-			tram[WIDTH_T], /* history for total RAM -> Graph */
-			tcache[WIDTH_T], /* history for cache_mark -> Graph */
-			tswap[WIDTH_T], /* history for swap/VRAM -> Graph */
+			prec_swap = 0; /* swap from previous round */
+	unsigned int
 #ifdef HAVE_NVIDIA
-			tgpu[WIDTH_T], /* history for GPU -> Graph */
 			use_gpu = 0,
 			prec_gpu = 0, /* GPU utilization from previous round */
 #endif
 			delay = 250000,
-			delta = 0,
+			sample_delay = SAMPLE_DELAY,
+			per_frame, /* samples per frame */
+			hidden_frame, /* samples per wakeup while hidden */
+			bar_n = 0, /* samples added up in bar_sum */
 			load = 0;
 
-	unsigned long	load0t = 0, load1t = 0, loadst = 0;
+	int		headless = 0, /* stream samples instead of drawing */
+			out_fmt = HEADLESS_CSV;
+	unsigned int	out_batch = 1; /* samples per write in headless mode */
+	const char	*out_file = NULL;
+	FILE		*out;
+
+	const char	*proc_root = NULL, /* data source, see Sysinfo_Setup */
+			*record_file = NULL,
+			*replay_file = NULL;
+	double		replay_speed = 1;
+	int		view = VIEW_NONE; /* shown instead of the memory lines */
+	const char	*view_arg = NULL;
+
+	struct pollfd	pfd[2];
 
 	unsigned int	*CPU_Load; /* CPU load per CPU array */
-	unsigned int	t_idx = 0; /* Index to load history tables */
+	unsigned int	*bar_sum; /* CPU loads added up since the last frame */
+	mem_snapshot	mem_snap; /* memory/swap usage of this round */
+	view_snapshot	prec_view = { { 0 }, 0, 0, -1 }; /* last view drawn */
+	unsigned int	runq = 0; /* runnable tasks of the last round */
+	collector	col; /* background sampler */
+	const sample	*smpl;
+	history		hist; /* everything shown in the graph */
+	unsigned char	*hval; /* one sample for the history */
+	char		hist_path[PATH_MAX];
+	graph		g = { &hist, 0, HIST_RAW, 0, VIEW_NONE, 0 }; /* what it shows */
 	
 	struct sigaction sigIntHandler;
 	sigIntHandler.sa_handler = sig_handler;
@@ -134,27 +170,71 @@ int main(int argc, char **argv)
 	sigaction(SIGQUIT, &sigIntHandler, NULL);
 
 	/********** Initialisation **********/
+	/* the data source options are needed before the first sample, the
+	 * loop below only skips them */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-psi"))
+			view = VIEW_PSI;
+		else if (i + 1 == argc)
+			break;
+		else if (!strcmp(argv[i], "-cgroup")) {
+			view = VIEW_CGROUP;
+			view_arg = argv[++i];
+		} else if (!strcmp(argv[i], "-disk")) {
+			view = VIEW_DISK;
+			view_arg = argv[++i];
+		} else if (!strcmp(argv[i], "-net")) {
+			view = VIEW_NET;
+			view_arg = argv[++i];
+		} else if (!strcmp(argv[i], "-proc-root"))
+			proc_root = argv[++i];
+		else if (!strcmp(argv[i], "-record"))
+			record_file = argv[++i];
+		else if (!strcmp(argv[i], "-replay"))
+			replay_file = argv[++i];
+		else if (!strcmp(argv[i], "-replay-speed"))
+			replay_speed = atof(argv[++i]);
+	}
+	if (Sysinfo_Setup(proc_root, record_file, replay_file, replay_speed) < 0)
+		usage(1, "-proc-root, -record and -replay need Linux!");
+	if (View_Setup(view, view_arg) < 0)
+		usage(1, "This view is not supported on this system!");
 	NumCPUs = NumCpus_DoInit();
 	CPU_Load = calloc((NumCPUs),sizeof(int));
-
-	if(NumCPUs == 1) {
-		load_width = 8;
-	} else if ( NumCPUs == 2) {
-			load_width = 3;
-	} else if ( NumCPUs == 4 || NumCPUs == 3) {
-			load_width = 2;
-	} else {
-			load_width = 1;
+	bar_sum = calloc(NumCPUs, sizeof(*bar_sum));
+	hval = malloc(HIST_CPU0 + NumCPUs);
+	g.cpus = NumCPUs;
+	g.view = view;
+	if (!CPU_Load || !bar_sum || !hval) {
+		fprintf(stderr, "Failed to allocate per-CPU state for %d CPUs\n",
+		    NumCPUs);
+		exit(1);
 	}
 
 
+
 	/* process command line args */
 	i = 1; /* skip program name (i=0) */
 	while (argc > i) {
+		if (!strcmp(argv[i], "-proc-root") || !strcmp(argv[i], "-record")
+		    || !strcmp(argv[i], "-replay")
+		    || !strcmp(argv[i], "-replay-speed")
+		    || !strcmp(argv[i], "-cgroup")
+		    || !strcmp(argv[i], "-disk")
+		    || !strcmp(argv[i], "-net")) {
+			if (i + 1 == argc)
+				usage(NumCPUs, "option needs an argument!");
+			i += 2;
+			continue;
+		}
+		if (!strcmp(argv[i], "-psi")) {
+			i++;
+			continue;
+		}
 		if (!strncmp(argv[i], "-r", 2)) {
 			i++;
-			if (i == argc) {
-				/* parameter missing! */
+			if (i == argc || atol(argv[i]) < 1) {
+				/* parameter missing or no rate at all */
 				usage(NumCPUs,
 				    "no refresh rate given when using -r!");
 			} else {
@@ -163,6 +243,42 @@ int main(int argc, char **argv)
 			i++;
 			continue;
 		}
+		if (!strcmp(argv[i], "-sample-rate")) {
+			i++;
+			if (i == argc || atol(argv[i]) < 1)
+				usage(NumCPUs, "no sample rate given when using -sample-rate!");
+			sample_delay = atol(argv[i]);
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "-headless")) {
+			headless = 1;
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "-format")) {
+			i++;
+			if (i == argc || (out_fmt = headless_format(argv[i])) < 0)
+				usage(NumCPUs, "-format needs csv, json or bin!");
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "-o")) {
+			i++;
+			if (i == argc)
+				usage(NumCPUs, "no file given when using -o!");
+			out_file = argv[i];
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "-batch")) {
+			i++;
+			if (i == argc || atoi(argv[i]) < 1)
+				usage(NumCPUs, "-batch needs a number of samples!");
+			out_batch = atoi(argv[i]);
+			i++;
+			continue;
+		}
 		if (!strncmp(argv[i], "-h", 2)) {
 			usage(NumCPUs, NULL);
 		}
@@ -192,13 +308,18 @@ int main(int argc, char **argv)
 			    etat = atoi(argv[i]);
 			}
 
-			if (1 > etat || etat > 3)
+			if (1 > etat || etat > STYLE_MAX)
 				usage(NumCPUs, "Unknown graph style");
 			i++;
 			continue;
 		}
 		if (!strncmp(argv[i], "-draw-mem", 9)) {
-			draw_mem = 1;
+			g.draw_mem = 1;
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "-draw-sched")) {
+			g.draw_sched = 1;
 			i++;
 			continue;
 		}
@@ -206,6 +327,38 @@ int main(int argc, char **argv)
 		/* if we get here, we found an illegal option */
 		usage(NumCPUs, "Illegal option!");
 	}
+
+	if (headless) {
+		/* no X at all: every sample goes to the output */
+		out = out_file ? fopen(out_file, "w") : stdout;
+		if (!out) {
+			fprintf(stderr, "Can't open %s: %s\n", out_file,
+			    strerror(errno));
+			exit(1);
+		}
+		if (collector_start(&col, NumCPUs, delay, 1, 1) < 0) {
+			fprintf(stderr, "Failed to start the sampler thread\n");
+			exit(1);
+		}
+		i = headless_run(&col, out, out_fmt, out_batch, &terminate);
+		if (i)
+			fprintf(stderr, "Writing samples failed: %s\n",
+			    strerror(errno));
+		collector_stop(&col);
+		Sysinfo_Close();
+		if (out != stdout)
+			fclose(out);
+		exit(i ? 1 : 0);
+	}
+	/* the history survives restarts in the user's runtime directory,
+	 * unless it is about some other system */
+	hist_path[0] = 0;
+	if (getenv("XDG_RUNTIME_DIR") && !proc_root && !replay_file)
+		snprintf(hist_path, sizeof(hist_path), "%s/" HIST_FILE,
+		    getenv("XDG_RUNTIME_DIR"));
+	history_init(&hist, NumCPUs, COLUMN_NS,
+	    hist_path[0] ? hist_path : NULL);
+
 	/* open initial window */
 	if (NumCPUs != 2) {
 		/* we only have a single CPU - change the mask accordingly
@@ -227,20 +380,27 @@ int main(int argc, char **argv)
 		copyXPMArea(12, 4, 2, HEIGHT + 2, 7, 4);
 	}
 
-	delay = delay / 2 ;
-
-	for (i = 0; i < WIDTH_T; i ++) {
-		t0[i] = 0;
-		t1[i] = 0;
-		tm[i] = 0;
-		tram[i] = 0;
-		tswap[i] = 0;
-		tcache[i] = 0;
-#ifdef HAVE_NVIDIA
-		tgpu[i] = 0;
-#endif
+	/* CPUs are sampled every 'sample_delay' and we wake up for a frame
+	 * every 'delay', memory is sampled every DIV1 + 1 frames. While
+	 * hidden, sampling goes on but we only wake up to keep the graph
+	 * history going. */
+	if (sample_delay > delay)
+		sample_delay = delay;
+	per_frame = delay / sample_delay;
+	hidden_frame = (delay > HIDDEN_DELAY ? delay : HIDDEN_DELAY) /
+	    sample_delay;
+	if (collector_start(&col, NumCPUs, sample_delay, (DIV1 + 1) * per_frame,
+	    per_frame) < 0) {
+		fprintf(stderr, "Failed to start the sampler thread\n");
+		exit(1);
 	}
 
+	/* we sleep until the X server or the sampler have news */
+	pfd[0].fd = x_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = col.wake_fd;
+	pfd[1].events = POLLIN;
+
 #ifdef HAVE_NVIDIA
 	if (use_gpu) {
 		// Init NVML here and if it is Ok,disable swap monitoring
@@ -279,38 +439,20 @@ int main(int argc, char **argv)
 }
 
 	/* MAIN LOOP */
-	while (1) {
-		if (lecture) {
-			CPU_Load = Get_CPU_Load(CPU_Load, NumCPUs);
-
-			load = 0;
-			offset = 0;
-			for (i = 0; i < NumCPUs; i++) {
-				load += CPU_Load[i];
-				delta = HEIGHT - CPU_Load[i];
-				if (NumCPUs == 2 && i == 1) {
-					offset=2;
-				}
-				copyXPMArea(108, 0, load_width, HEIGHT, 4 + i * load_width + offset, 5);
-				copyXPMArea(108, 32 + delta, load_width, CPU_Load[i],
-				    4 + i * load_width + offset, 5 + delta);
-			}
-			load = load / NumCPUs;
-
-
-			/* we have to set load1t in any case to get the correct
-			 * graph below. With only one CPU, 'load' will still be
-			 * CPU_Load[0], on a SMP system, it will be CPU_Load[1].
-			 */
-			load0t += CPU_Load[0];
-			if (NumCPUs == 2) {
-				load1t += CPU_Load[1];
-			}
-			loadst += load;
-
-			if (c1 > DIV1) {
-				mem = Get_Memory();
-				mem2 = Get_Memory2();
+	while (!terminate) {
+		/* account for every sample taken since the last frame */
+		collector_ack(&col);
+		while ((smpl = collector_peek(&col))) {
+			memcpy(CPU_Load, smpl->load, NumCPUs * sizeof(*CPU_Load));
+			for (i = 0; i < NumCPUs; i++)
+				bar_sum[i] += CPU_Load[i];
+			bar_n++;
+
+			if (smpl->has_mem) {
+				runq = smpl->sched.running;
+				mem_snap = smpl->mem;
+				mem = mem_snap.mem;
+				mem2 = mem_snap.mem2;
 
 				if (mem != prec_mem || mem2 != prec_mem2) {
 					/* redraw only if mem changed */
@@ -320,8 +462,22 @@ int main(int argc, char **argv)
 					prec_mem = mem;
 					prec_mem2 = mem2;
 				}
-				if (!no_swap) {
-					mem = Get_Swap();
+				if (view) {
+					/* the view takes the swap bar */
+					if (memcmp(&smpl->view, &prec_view,
+					    sizeof(prec_view))) {
+						prec_view = smpl->view;
+						copyXPMArea(VIEW_LABEL_X(view),
+						    prec_view.alert ? VIEW_ALERT_Y :
+						    VIEW_LABEL_Y, 18, 8, 6, 50);
+						copyXPMArea(30, 63, 30, 8, 29, 50);
+						copyXPMArea(0, 63, prec_view.bar * 30 / 100,
+						    8, 29, 50);
+						copyXPMArea(115, 63, 1, 8,
+						    prec_view.mark * 29 / 100 + 29, 50);
+					}
+				} else if (!no_swap) {
+					mem = mem_snap.swap;
 
 					if (mem != prec_swap) {
 						/* redraw if there was a change */
@@ -351,10 +507,9 @@ int main(int argc, char **argv)
 						prec_swap = mem;
 					}
 				}
-				c1 = 0;
 
 #ifdef HAVE_NVIDIA
-				if (use_gpu) {
+				if (use_gpu && !view) {
 					mem = Get_VRAM();
 					mem2 = Get_GPU();
 					copyXPMArea(75, 71, 18, 8, 6, 50);
@@ -367,94 +522,140 @@ int main(int argc, char **argv)
 #endif
 			}
 
-			if (c2 > DIV2) {
-				if (draw_mem) {
-					tram[t_idx] = prec_mem * HEIGHT / 100;
-					tcache[t_idx] = prec_mem2 * HEIGHT / 100;
-#ifdef HAVE_NVIDIA
-					tgpu[t_idx] = prec_gpu * HEIGHT / 100;
-#endif
-					if (!no_swap) tswap[t_idx] = prec_swap * HEIGHT / 100;
-					else { 
+			/* graph rows cover COLUMN_TIME or more each,
+			 * independent of the sampling rate */
+			load = 0;
+			for (i = 0; i < NumCPUs; i++) {
+				load += CPU_Load[i];
+				hval[HIST_CPU0 + i] = CPU_Load[i] > HEIGHT ?
+				    HEIGHT : CPU_Load[i];
+			}
+			hval[HIST_ALL] = load / NumCPUs > HEIGHT ?
+			    HEIGHT : load / NumCPUs;
+			hval[HIST_RAM] = prec_mem * HEIGHT / 100;
+			hval[HIST_CACHE] = prec_mem2 * HEIGHT / 100;
 #ifdef HAVE_NVIDIA
-						if (use_gpu) {
-							tswap[t_idx] = prec_swap  * HEIGHT / 100;
-						} else
+			hval[HIST_GPU] = prec_gpu * HEIGHT / 100;
+			if (use_gpu)
+				hval[HIST_SWAP] = prec_swap * HEIGHT / 100;
+			else
 #endif
-						tswap[t_idx] = 0;
-					}
-				}
-				if ((t0[t_idx] = load0t / c2) > HEIGHT)
-					t0[t_idx] = HEIGHT;
-				t0[t_idx] /= 2;
-				if ((t1[t_idx] = load1t / c2) > HEIGHT)
-					t1[t_idx] = HEIGHT;
-				t1[t_idx] /= 2;
-				if (NumCPUs == 2) {
-					if ((tm[t_idx] = (load0t + load1t) / (2 * c2)) > HEIGHT)
-						tm[t_idx] = HEIGHT;
-				} else {
-						if ((tm[t_idx] = loadst / c2) > HEIGHT)
-							tm[t_idx] = HEIGHT;
-				}
-				load0t = 0;
-				load1t = 0;
-				loadst = 0;
-				t_idx = (t_idx + 1) % WIDTH_T;
-				draw_graph = 1;
-				c2 = 0;
+			hval[HIST_SWAP] = no_swap ? 0 : prec_swap * HEIGHT / 100;
+			for (i = 0; i < VIEW_LINES; i++)
+				hval[HIST_VIEW + i] =
+				    prec_view.line[i] * HEIGHT / 100;
+			hval[HIST_RUNQ] = runq >= 2U * NumCPUs ? HEIGHT :
+			    runq * HEIGHT / (2 * NumCPUs);
+			load = history_add(&hist, smpl->ts, hval, g.tier);
+			if (draw_graph + load > WIDTH_T)
+				draw_graph = WIDTH_T + 1;
+			else
+				draw_graph += load; /* number of new columns */
+
+			collector_release(&col);
+			new_sample = 1;
+		}
+
+		if (new_sample && visible) {
+			/* load bars show the mean of the samples since the
+			 * last frame */
+			for (i = 0; bar_n && i < NumCPUs; i++)
+				CPU_Load[i] = bar_sum[i] / bar_n;
+			bars_draw(CPU_Load, NumCPUs);
+			new_sample = 0;
+		}
+		if (!new_sample || !visible) {
+			memset(bar_sum, 0, NumCPUs * sizeof(*bar_sum));
+			bar_n = 0;
+		}
+
+		if (draw_graph && visible) {
+			/* the graph only moves by whole columns: scroll the
+			 * existing image left and paint the new columns only */
+			if (full_graph || draw_graph >= WIDTH_T) {
+				graph_draw(&g, etat, 0);
+			} else {
+				graph_scroll(draw_graph);
+				graph_draw(&g, etat, WIDTH_T - draw_graph);
 			}
+			draw_graph = 0;
+			full_graph = 0;
+		}
 
-				if (draw_graph) {
-				/* draw graph */
-				switch (etat) {
-				case 1 :
-					copyXPMArea(64, 32, WIDTH_T, HEIGHT, 15, 5);
-					for (i = 0, load = t_idx; i < WIDTH_T; i++, load++) {
-						copyXPMArea(116, 0, 1, tm[load % WIDTH_T], 15 + i, HEIGHT + 5 - tm[load % WIDTH_T]);
-						if (draw_mem) {
-							if (tram[load % WIDTH_T] != 0) copyXPMArea(68, 73, 1, 1, 15 + i, HEIGHT + 5 - tram[load % WIDTH_T]);
-							if (tcache[load % WIDTH_T] != 0) copyXPMArea(68, 72, 1, 1, 15 + i, HEIGHT + 5 - tcache[load % WIDTH_T]);
-							if (tswap[load % WIDTH_T] != 0 ) copyXPMArea(68, 71, 1, 1, 15 + i, HEIGHT + 5 - tswap[load % WIDTH_T]);
-#ifdef HAVE_NVIDIA
-							if (tgpu[load % WIDTH_T] != 0 ) copyXPMArea(68, 74, 1, 1, 15 + i, HEIGHT + 5 - tgpu[load % WIDTH_T]);
-#endif
-						}
-					}
-					break;
-				case 2 :
-					copyXPMArea(64, 0, WIDTH_T, HEIGHT, 15, 5);
-					for (i = 0, load = t_idx; i < WIDTH_T; i ++, load++) {
-						copyXPMArea(116, 0, 1, t0[load % WIDTH_T], 15 + i, HEIGHT/2 + 5 - t0[load % WIDTH_T]);
-						copyXPMArea(116, 0, 1, t1[load % WIDTH_T], 15 + i, HEIGHT/2 + 21 - t1[load % WIDTH_T]);
-					}
+		/* X events are handled as soon as they arrive */
+		while (XPending(display)) {
+			XNextEvent(display, &Event);
+			switch (Event.type) {
+			case Expose :
+				ExposeWindow();
+				/* fall through */
+			case MapNotify :
+			case UnmapNotify :
+			case VisibilityNotify :
+				if (UpdateVisibility(&Event) == visible)
 					break;
-				case 3 :
-					copyXPMArea(64, 0, WIDTH_T, HEIGHT, 15, 5);
-					for (i = 0, load = t_idx; i < WIDTH_T; i ++, load++) {
-						copyXPMArea(116, 0, 1, t0[load % WIDTH_T], 15 + i, HEIGHT/2 + 5 - t0[load % WIDTH_T]);
-						copyXPMArea(117, HEIGHT/2 - t1[load % WIDTH_T], 1, t1[load % WIDTH_T], 15 + i, HEIGHT/2 + 6);
-					}
+				visible = !visible;
+				if (visible) {
+					/* catch up on what happened while hidden */
+					collector_set_period(&col, sample_delay,
+					    (DIV1 + 1) * per_frame, per_frame);
+					new_sample = 1;
+					draw_graph = 1;
+					full_graph = 1;
+					ExposeWindow();
+				} else {
+					/* keep only the graph history going */
+					collector_set_period(&col, sample_delay,
+					    hidden_frame, hidden_frame);
+				}
+				break;
+			case ButtonPress :
+				/* the wheel zooms through the history tiers */
+				if (Event.xbutton.button == Button4 ||
+				    Event.xbutton.button == Button5) {
+					if (Event.xbutton.button == Button5 &&
+					    g.tier + 1 < HIST_TIERS)
+						g.tier++;
+					else if (Event.xbutton.button == Button4 &&
+					    g.tier > 0)
+						g.tier--;
+					else
+						break;
+					draw_graph = 1;
+					full_graph = 1;
 					break;
 				}
-				draw_graph = 0;
-			}
-			c1++;
-			c2++;
-		}
-		lecture = 1 - lecture ;
-		RedrawWindow();
-		if (NumCPUs == 2 &&
-		    XCheckMaskEvent(display, ButtonPressMask, &Event)) {
-			/* changing graph style not supported on single CPU systems */
-			if (Event.type == ButtonPress) {
-				if ((etat++) >= 3)
+				/* changing graph style not supported on single
+				 * CPU systems */
+				if (NumCPUs == 1)
+					break;
+				if (NumCPUs > 2) {
+					/* the split styles only show CPU 0 and 1 */
+					etat = (etat == 1) ? STYLE_HEATMAP : 1;
+				} else if ((etat++) >= STYLE_MAX)
 					etat = 1;
 				draw_graph = 1;
+				full_graph = 1;
+				break;
 			}
 		}
-		usleep(delay);
+		if (draw_graph && visible)
+			continue; /* repaint the graph before sleeping */
+		/* sends only what changed, nothing on idle wakeups */
+		if (visible)
+			RedrawWindow();
+		XFlush(display);
+		poll(pfd, 2, -1);
 	}
+
+	printf("Caught signal %d, terminating gracefully\n", (int)terminate);
+	collector_stop(&col);
+	history_free(&hist);
+#ifdef HAVE_NVIDIA
+	nvmlShutdown();
+#endif
+	Sysinfo_Close();
+	exit(0);
 }
 
 /*###### Usage Message ##################################################*/
@@ -473,15 +674,36 @@ void usage(int cpus, const char *str)
 		fputs("multiprocessor system)\n\n", stderr);
 	}
 	fputs("Options : -h        this help screen.\n"
-	    "          -r RATE   refresh rate (in microseconds, default 250000).\n",
+	    "          -r RATE   refresh rate (in microseconds, default 250000).\n"
+	    "          -sample-rate RATE  sampling rate (in microseconds,\n"
+	    "                    default 20000).\n",
 	    stderr);
 
 	if(cpus > 1) {
-		fputs("          -g STYLE  graph style (try 2 or 3, default is 1).\n",
+		fputs("          -g STYLE  graph style (try 2 or 3, 4 for a per-CPU heatmap,\n"
+		    "                    default is 1).\n",
 		    stderr);
 	}
 
 	fputs("          -no-swap  don't monitor swap size.\n", stderr);
+	fputs("          -psi      show CPU (red), memory (yellow) and io (blue)\n"
+	    "                    pressure instead of memory and swap.\n"
+	    "          -cgroup PATH  show the CPU and memory of cgroup PATH\n"
+	    "                    instead, red when it is throttled.\n"
+	    "          -disk DEV show the I/O of block device DEV instead.\n"
+	    "          -net IF   show the traffic of interface IF (or all) instead.\n"
+	    "          -draw-sched draw the runnable tasks, red when more than CPUs.\n",
+	    stderr);
+	fputs("          -headless stream samples instead of showing them.\n"
+	    "          -format FMT  headless output: csv (default), json or bin.\n"
+	    "          -o FILE   headless output file (default stdout).\n"
+	    "          -batch N  headless: write every N samples (default 1).\n",
+	    stderr);
+	fputs("          -proc-root DIR  read DIR/proc instead of /proc.\n"
+	    "          -record FILE    append everything read to FILE.\n"
+	    "          -replay FILE    show a recorded FILE instead of this system.\n"
+	    "          -replay-speed X replay X times faster (0: no waiting).\n",
+	    stderr);
 #ifdef HAVE_NVIDIA
 	fputs("          -nvidia  monitor NVidia GPU instead of swap.\n", stderr);
 	fputs("          -draw-mem draw memory usage graph (red - swap or Video RAM (if nvidia enabled), yellow - non-cached, blue - allocated, white - GPU usage)\n\n", stderr);
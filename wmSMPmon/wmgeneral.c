@@ -38,6 +38,10 @@
 
 */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -48,6 +52,11 @@
 #include <X11/Xlib.h>
 #include <X11/xpm.h>
 #include <X11/extensions/shape.h>
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 
 #include "wmgeneral.h"
 
@@ -55,6 +64,7 @@
  /* X11 Variables */
 /*****************/
 
+Display		*display;
 Window		Root;
 int			screen;
 int			x_fd;
@@ -68,6 +78,41 @@ GC			NormalGC;
 XpmIcon		wmgen;
 Pixmap		pixmask;
 
+  /*******************************/
+ /* Client-side frame buffer    */
+/*******************************/
+
+/* All drawing happens in a client-side copy of the master XPM; only the
+ * visible 64x64 part is sent to the server when the window is redrawn. */
+static XImage	*frame;
+#ifdef HAVE_XSHM
+static XShmSegmentInfo	shminfo;
+static int		use_shm;
+static int		shm_failed;
+#endif
+
+/* Areas of the visible part changed since the last RedrawWindow(). Close
+ * or overlapping areas are merged; when the list is full it collapses
+ * into its bounding box. */
+#define MAX_DAMAGE	8
+static XRectangle	damage[MAX_DAMAGE];
+static int		damage_count;
+static int		exposed = 1;	/* windows need a full copy */
+
+/* The visible rows as last sent to the server pixmap. A damaged row that
+ * was only drawn over with what it showed before, e.g. a graph column
+ * repainted with the same values, is not sent again. */
+static char		*shown;
+
+  /**************/
+ /* Visibility */
+/**************/
+
+/* Per window: mapped and not fully covered. Window Maker shows iconwin
+ * and keeps win withdrawn, other window managers may do it the other way
+ * round, so the dockapp counts as visible if either one is. */
+static int		win_shown, iconwin_shown;
+
   /*****************/
  /* Mouse Regions */
 /*****************/
@@ -88,6 +133,12 @@ MOUSE_REGION	mouse_region[MAX_MOUSE_REGION];
 
 static void GetXPM(XpmIcon *, char **);
 static Pixel GetColor(char *);
+static void GetFrame(void);
+static void PutFrame(void);
+static void GetShown(void);
+static void TrimDamage(void);
+static void AddDamage(int, int, int, int);
+static int CopyRow(int, int, int, int, int);
 void RedrawWindow(void);
 void AddMouseRegion(int, int, int, int, int);
 int CheckMouseRegion(int, int);
@@ -219,18 +270,355 @@ static int flush_expose(Window w) {
 	return i;
 }
 
+/***************************************************************************\
+|* GetFrame								   *|
+|*                                                                         *|
+|* fetches the master XPM into the client-side frame buffer, in shared     *|
+|* memory if the server supports MIT-SHM and runs on this machine          *|
+\***************************************************************************/
+
+#ifdef HAVE_XSHM
+static int shm_error(Display *d, XErrorEvent *e) {
+
+	(void)d;
+	(void)e;
+	/* XShmAttach fails for remote servers even if they have MIT-SHM */
+	shm_failed = 1;
+	return 0;
+}
+#endif
+
+static void GetFrame(void) {
+
+	unsigned int	width = wmgen.attributes.width,
+			height = wmgen.attributes.height;
+
+#ifdef HAVE_XSHM
+	if (XShmQueryExtension(display)) {
+		XErrorHandler	old;
+
+		frame = XShmCreateImage(display,
+		    DefaultVisual(display, screen), d_depth, ZPixmap, NULL,
+		    &shminfo, width, height);
+		if (frame) {
+			shminfo.shmid = shmget(IPC_PRIVATE,
+			    frame->bytes_per_line * frame->height,
+			    IPC_CREAT | 0600);
+			shminfo.shmaddr = frame->data = shminfo.shmid == -1 ?
+			    (char *)-1 : shmat(shminfo.shmid, NULL, 0);
+			shminfo.readOnly = True;
+			if (shminfo.shmaddr != (char *)-1) {
+				old = XSetErrorHandler(shm_error);
+				XShmAttach(display, &shminfo);
+				XSync(display, False);
+				XSetErrorHandler(old);
+				/* gone once both sides detached */
+				shmctl(shminfo.shmid, IPC_RMID, NULL);
+				use_shm = !shm_failed;
+			}
+			if (use_shm) {
+				XShmGetImage(display, wmgen.pixmap, frame, 0, 0,
+				    AllPlanes);
+				return;
+			}
+			if (shminfo.shmaddr != (char *)-1)
+				shmdt(shminfo.shmaddr);
+			frame->data = NULL;
+			XDestroyImage(frame);
+		}
+	}
+#endif
+	frame = XGetImage(display, wmgen.pixmap, 0, 0, width, height,
+	    AllPlanes, ZPixmap);
+	if (!frame) {
+		fprintf(stderr, "Can't create the frame buffer.\n");
+		exit(1);
+	}
+}
+
+/***************************************************************************\
+|* AddDamage								   *|
+|*                                                                         *|
+|* records that an area of the frame buffer has to be sent to the server   *|
+\***************************************************************************/
+
+static void AddDamage(int x, int y, int w, int h) {
+
+	int		i, x2, y2,
+			vw = wmgen.attributes.width < 64 ? wmgen.attributes.width : 64,
+			vh = wmgen.attributes.height < 64 ? wmgen.attributes.height : 64;
+
+	/* only the top left 64x64 pixels are ever shown */
+	if (x + w > vw) w = vw - x;
+	if (y + h > vh) h = vh - y;
+	if (w <= 0 || h <= 0)
+		return;
+
+	/* take out every area it overlaps or touches and grow it to cover
+	 * them; a grown area may reach others, so repeat until none is left */
+	for (;;) {
+		for (i = 0; i < damage_count; i++) {
+			if (x <= damage[i].x + damage[i].width &&
+			    damage[i].x <= x + w &&
+			    y <= damage[i].y + damage[i].height &&
+			    damage[i].y <= y + h)
+				break;
+		}
+		if (i == damage_count)
+			break;
+		x2 = x + w > damage[i].x + damage[i].width ?
+		    x + w : damage[i].x + damage[i].width;
+		y2 = y + h > damage[i].y + damage[i].height ?
+		    y + h : damage[i].y + damage[i].height;
+		x = x < damage[i].x ? x : damage[i].x;
+		y = y < damage[i].y ? y : damage[i].y;
+		w = x2 - x;
+		h = y2 - y;
+		damage[i] = damage[--damage_count];
+	}
+
+	/* list full: fold everything into one area */
+	if (damage_count == MAX_DAMAGE) {
+		for (i = 0; i < damage_count; i++) {
+			x2 = damage[i].x + damage[i].width;
+			y2 = damage[i].y + damage[i].height;
+			if (x2 < x + w) x2 = x + w;
+			if (y2 < y + h) y2 = y + h;
+			if (x > damage[i].x) x = damage[i].x;
+			if (y > damage[i].y) y = damage[i].y;
+			w = x2 - x;
+			h = y2 - y;
+		}
+		damage_count = 0;
+	}
+	damage[damage_count].x = x;
+	damage[damage_count].y = y;
+	damage[damage_count].width = w;
+	damage[damage_count].height = h;
+	damage_count++;
+}
+
+/***************************************************************************\
+|* GetShown								   *|
+|*                                                                         *|
+|* keeps a copy of the visible rows of the new frame buffer, which the     *|
+|* server pixmap holds as well                                             *|
+\***************************************************************************/
+
+static void GetShown(void) {
+
+	int		vh = frame->height < 64 ? frame->height : 64;
+
+	if (!(shown = malloc(vh * frame->bytes_per_line))) {
+		fprintf(stderr, "Can't create the frame buffer.\n");
+		exit(1);
+	}
+	memcpy(shown, frame->data, vh * frame->bytes_per_line);
+}
+
+/***************************************************************************\
+|* TrimDamage								   *|
+|*                                                                         *|
+|* shrinks each damaged area to the rows that differ from what was sent,   *|
+|* dropping areas that don't differ at all, and records them as sent       *|
+\***************************************************************************/
+
+static void TrimDamage(void) {
+
+	int		i, n = 0, row, first, last = 0, from, len;
+	char	*src, *dst;
+
+	for (i = 0; i < damage_count; i++) {
+		from = damage[i].x * frame->bits_per_pixel / 8;
+		len = ((damage[i].x + damage[i].width) * frame->bits_per_pixel
+		    + 7) / 8 - from;
+		first = -1;
+		for (row = damage[i].y; row < damage[i].y + damage[i].height;
+		    row++) {
+			src = frame->data + row * frame->bytes_per_line + from;
+			dst = shown + row * frame->bytes_per_line + from;
+			if (!memcmp(dst, src, len))
+				continue;
+			memcpy(dst, src, len);
+			if (first < 0)
+				first = row;
+			last = row;
+		}
+		if (first < 0)
+			continue;
+		damage[n] = damage[i];
+		damage[n].y = first;
+		damage[n].height = last - first + 1;
+		n++;
+	}
+	damage_count = n;
+}
+
+/***************************************************************************\
+|* PutFrame								   *|
+|*                                                                         *|
+|* sends the damaged parts of the frame buffer to the server pixmap        *|
+\***************************************************************************/
+
+static void PutFrame(void) {
+
+	int		i;
+
+	TrimDamage();
+	for (i = 0; i < damage_count; i++) {
+#ifdef HAVE_XSHM
+		if (use_shm) {
+			XShmPutImage(display, wmgen.pixmap, NormalGC, frame,
+			    damage[i].x, damage[i].y, damage[i].x, damage[i].y,
+			    damage[i].width, damage[i].height, False);
+			continue;
+		}
+#endif
+		XPutImage(display, wmgen.pixmap, NormalGC, frame,
+		    damage[i].x, damage[i].y, damage[i].x, damage[i].y,
+		    damage[i].width, damage[i].height);
+	}
+#ifdef HAVE_XSHM
+	/* don't let the next frame be drawn while the server reads */
+	if (use_shm && damage_count)
+		XSync(display, False);
+#endif
+}
+
 /***************************************************************************\
 |* RedrawWindow								   *|
 \***************************************************************************/
 
 void RedrawWindow(void) {
 
-	flush_expose(iconwin);
-	XCopyArea(display, wmgen.pixmap, iconwin, NormalGC,
-				0,0, wmgen.attributes.width, wmgen.attributes.height, 0,0);
-	flush_expose(win);
-	XCopyArea(display, wmgen.pixmap, win, NormalGC,
-				0,0, wmgen.attributes.width, wmgen.attributes.height, 0,0);
+	int		i;
+
+	/* an idle frame costs no requests at all */
+	if (!damage_count && !exposed)
+		return;
+
+	PutFrame();
+	if (flush_expose(iconwin) + flush_expose(win))
+		exposed = 1;
+	if (exposed) {
+		XCopyArea(display, wmgen.pixmap, iconwin, NormalGC,
+					0,0, wmgen.attributes.width, wmgen.attributes.height, 0,0);
+		XCopyArea(display, wmgen.pixmap, win, NormalGC,
+					0,0, wmgen.attributes.width, wmgen.attributes.height, 0,0);
+	} else {
+		for (i = 0; i < damage_count; i++) {
+			XCopyArea(display, wmgen.pixmap, iconwin, NormalGC,
+			    damage[i].x, damage[i].y, damage[i].width,
+			    damage[i].height, damage[i].x, damage[i].y);
+			XCopyArea(display, wmgen.pixmap, win, NormalGC,
+			    damage[i].x, damage[i].y, damage[i].width,
+			    damage[i].height, damage[i].x, damage[i].y);
+		}
+	}
+	damage_count = 0;
+	exposed = 0;
+}
+
+/***************************************************************************\
+|* ExposeWindow								   *|
+|*                                                                         *|
+|* makes the next RedrawWindow() copy the whole pixmap, e.g. on Expose     *|
+\***************************************************************************/
+
+void ExposeWindow(void) {
+
+	exposed = 1;
+}
+
+/***************************************************************************\
+|* openFrame								   *|
+|*                                                                         *|
+|* sets up the frame buffer from the master XPM without an X server, to    *|
+|* draw off screen, e.g. in 'make bench'. Pixels are the XPM color         *|
+|* indices. RedrawWindow() must not be called; see TakeDamage()            *|
+\***************************************************************************/
+
+void openFrame(char *pixmap_bytes[]) {
+
+	XpmImage	xpm;
+	unsigned int	i;
+
+	if (XpmCreateXpmImageFromData(pixmap_bytes, &xpm, NULL) != XpmSuccess) {
+		fprintf(stderr, "Can't read the master XPM.\n");
+		exit(1);
+	}
+	frame = calloc(1, sizeof(*frame));
+	if (!frame || !(frame->data = malloc(xpm.width * xpm.height * 4))) {
+		fprintf(stderr, "Can't create the frame buffer.\n");
+		exit(1);
+	}
+	frame->width = xpm.width;
+	frame->height = xpm.height;
+	frame->format = ZPixmap;
+	frame->byte_order = frame->bitmap_bit_order = LSBFirst;
+	frame->bitmap_unit = frame->bitmap_pad = 32;
+	frame->depth = 24;
+	frame->bits_per_pixel = 32;
+	frame->bytes_per_line = xpm.width * 4;
+	XInitImage(frame);
+	for (i = 0; i < xpm.width * xpm.height; i++)
+		XPutPixel(frame, i % xpm.width, i / xpm.width, xpm.data[i]);
+	XpmFreeXpmImage(&xpm);
+
+	wmgen.attributes.width = frame->width;
+	wmgen.attributes.height = frame->height;
+	GetShown();
+}
+
+/***************************************************************************\
+|* TakeDamage								   *|
+|*                                                                         *|
+|* returns the number of pixels the next RedrawWindow() would send, and    *|
+|* forgets them like it does                                               *|
+\***************************************************************************/
+
+int TakeDamage(void) {
+
+	int		i, pixels = 0;
+
+	TrimDamage();
+	for (i = 0; i < damage_count; i++)
+		pixels += damage[i].width * damage[i].height;
+	damage_count = 0;
+	return pixels;
+}
+
+/***************************************************************************\
+|* UpdateVisibility							   *|
+|*                                                                         *|
+|* follows Map/Unmap/Visibility/Expose events, returns 1 while any of the  *|
+|* two windows can be seen                                                 *|
+\***************************************************************************/
+
+int UpdateVisibility(XEvent *event) {
+
+	int		*shown;
+
+	if (event->xany.window == win)
+		shown = &win_shown;
+	else if (event->xany.window == iconwin)
+		shown = &iconwin_shown;
+	else
+		return win_shown || iconwin_shown;
+
+	switch (event->type) {
+	case MapNotify :
+	case Expose :	/* only viewable windows get these */
+		*shown = 1;
+		break;
+	case UnmapNotify :
+		*shown = 0;
+		break;
+	case VisibilityNotify :
+		*shown = event->xvisibility.state != VisibilityFullyObscured;
+		break;
+	}
+	return win_shown || iconwin_shown;
 }
 
 /***************************************************************************\
@@ -239,6 +627,9 @@ void RedrawWindow(void) {
 
 void RedrawWindowXY(int x, int y) {
 
+	PutFrame();
+	damage_count = 0;
+	exposed = 0;
 	flush_expose(iconwin);
 	XCopyArea(display, wmgen.pixmap, iconwin, NormalGC,
 				x,y, wmgen.attributes.width, wmgen.attributes.height, 0,0);
@@ -330,6 +721,30 @@ void createXBMfromXPM(char *xbm, char **xpm, int sx, int sy) {
 	}
 }
 
+/***************************************************************************\
+|* CopyRow								   *|
+|*                                                                         *|
+|* copies n pixels of the frame buffer one by one, for depths that are     *|
+|* not whole bytes; returns 0 if the target held the same pixels already   *|
+\***************************************************************************/
+
+static int CopyRow(int x, int y, int n, int dx, int dy) {
+
+	int		i, col, changed = 0;
+	unsigned long	pixel;
+
+	for (i = 0; i < n; i++) {
+		/* right to left when moving right within the row */
+		col = dx > x ? n - 1 - i : i;
+		pixel = XGetPixel(frame, x + col, y);
+		if (XGetPixel(frame, dx + col, dy) != pixel) {
+			XPutPixel(frame, dx + col, dy, pixel);
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
 /***************************************************************************\
 |* copyXPMArea								   *|
 |*                                                                         *|
@@ -342,8 +757,42 @@ void createXBMfromXPM(char *xbm, char **xpm, int sx, int sy) {
 
 void copyXPMArea(int x, int y, int sx, int sy, int dx, int dy)
 {
-	XCopyArea(display, wmgen.pixmap, wmgen.pixmap, NormalGC,
-	    x, y, sx, sy, dx, dy);
+	int		bpp = frame->bits_per_pixel / 8,
+			row, step, first, last = -1;
+	char	*src, *dst;
+
+	/* clip like XCopyArea: to the source, then to the destination */
+	if (x < 0) { sx += x; dx -= x; x = 0; }
+	if (y < 0) { sy += y; dy -= y; y = 0; }
+	if (dx < 0) { sx += dx; x -= dx; dx = 0; }
+	if (dy < 0) { sy += dy; y -= dy; dy = 0; }
+	if (x + sx > frame->width) sx = frame->width - x;
+	if (y + sy > frame->height) sy = frame->height - y;
+	if (dx + sx > frame->width) sx = frame->width - dx;
+	if (dy + sy > frame->height) sy = frame->height - dy;
+	if (sx <= 0 || sy <= 0)
+		return;
+
+	/* copy bottom-up when moving down within overlapping rows; rows
+	 * that already hold the same pixels are skipped, so that redrawing
+	 * an unchanged area damages nothing */
+	row = dy > y ? sy - 1 : 0;
+	step = dy > y ? -1 : 1;
+	for (first = sy; row >= 0 && row < sy; row += step) {
+		if (frame->bits_per_pixel % 8 == 0) {
+			src = frame->data + (y + row) * frame->bytes_per_line + x * bpp;
+			dst = frame->data + (dy + row) * frame->bytes_per_line + dx * bpp;
+			if (!memcmp(dst, src, sx * bpp))
+				continue;
+			memmove(dst, src, sx * bpp);
+		} else if (!CopyRow(x, y + row, sx, dx, dy + row)) {
+			continue;
+		}
+		if (row < first) first = row;
+		if (row > last) last = row;
+	}
+	if (last >= 0)
+		AddDamage(dx, dy + first, sx, last - first + 1);
 }
 
 /***************************************************************************\
@@ -358,8 +807,13 @@ void copyXPMArea(int x, int y, int sx, int sy, int dx, int dy)
 
 void copyXBMArea(int x, int y, int sx, int sy, int dx, int dy)
 {
+	/* rare: done by the server, then fetched back into the frame */
+	PutFrame();
 	XCopyArea(display, wmgen.mask, wmgen.pixmap, NormalGC,
 	    x, y, sx, sy, dx, dy);
+	XGetSubImage(display, wmgen.pixmap, dx, dy, sx, sy, AllPlanes,
+	    ZPixmap, frame, dx, dy);
+	AddDamage(dx, dy, sx, sy);
 }
 
 
@@ -445,8 +899,8 @@ void openXwindow(int argc, char *argv[], char *pixmap_bytes[], char *pixmask_bit
 	classHint.res_class = wname;
 	XSetClassHint(display, win, &classHint);
 
-	XSelectInput(display, win, ButtonPressMask | ExposureMask | ButtonReleaseMask | PointerMotionMask | StructureNotifyMask);
-	XSelectInput(display, iconwin, ButtonPressMask | ExposureMask | ButtonReleaseMask | PointerMotionMask | StructureNotifyMask);
+	XSelectInput(display, win, ButtonPressMask | ExposureMask | ButtonReleaseMask | PointerMotionMask | StructureNotifyMask | VisibilityChangeMask);
+	XSelectInput(display, iconwin, ButtonPressMask | ExposureMask | ButtonReleaseMask | PointerMotionMask | StructureNotifyMask | VisibilityChangeMask);
 
 	if (XStringListToTextProperty(&wname, 1, &name) == 0) {
 		fprintf(stderr, "%s: can't allocate window name\n", wname);
@@ -463,6 +917,10 @@ void openXwindow(int argc, char *argv[], char *pixmap_bytes[], char *pixmask_bit
 	gcv.graphics_exposures = 0;
 	NormalGC = XCreateGC(display, Root, gcm, &gcv);
 
+	/* all drawing goes to a client-side copy of the pixmap */
+	GetFrame();
+	GetShown();
+
 	/* ONLYSHAPE ON */
 
 	pixmask = XCreateBitmapFromData(display, win, pixmask_bits, pixmask_width, pixmask_height);
@@ -32,11 +32,12 @@ typedef struct {
 	XpmAttributes	attributes;
 } XpmIcon;
 
-  /*******************/
- /* Global variable */
-/*******************/
+  /********************/
+ /* Global variables */
+/********************/
 
-static Display		*display;
+extern Display		*display;
+extern int			x_fd;	/* connection to the X server, for poll() */
 
   /***********************/
  /* Function Prototypes */
@@ -48,6 +49,10 @@ int CheckMouseRegion(int x, int y);
 void openXwindow(int argc, char *argv[], char **, char *, int, int);
 void RedrawWindow(void);
 void RedrawWindowXY(int x, int y);
+void ExposeWindow(void);
+void openFrame(char **);
+int TakeDamage(void);
+int UpdateVisibility(XEvent *event);
 
 void createXBMfromXPM(char *, char **, int, int);
 void copyXPMArea(int, int, int, int, int, int);